@@ -20,20 +20,41 @@
 
 #define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
 
+#include <kunit/static_stub.h>
 #include <linux/cleanup.h>
+#include <linux/debugfs.h>
 #include <linux/device.h>
 #include <linux/file.h>
 #include <linux/fs.h>
 #include <linux/hwmon.h>
 #include <linux/hwmon-sysfs.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/iio.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
 #include <linux/kernel.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
 #include <linux/module.h>
+#include <linux/percpu.h>
 #include <linux/rwsem.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/thermal.h>
 #include <linux/uaccess.h>
+#include <linux/workqueue.h>
 
 #include "amdgpu_metrics.h"
 
+#define CREATE_TRACE_POINTS
+#include "amdgpu_metrics_trace.h"
+
+/* Overridden by amdgpu_metrics_kunit.c, so that both can be loaded */
+#ifndef MODULE_NAME
 #define MODULE_NAME	"amdgpu_metrics"
+#endif
 
 /*
  * It is not a good idea to open files from kernel space, but this is the least
@@ -54,6 +75,24 @@ MODULE_PARM_DESC(gpu_metrics,
 	"(Empty): ERROR! "
 	"Default: " DEFAULT_GPU_METRICS_PATH);
 
+/*
+ * Companion tables read in the same refresh as gpu_metrics, so that they share
+ * its generation instead of costing SMU round-trips on their own schedules.
+ */
+static char pm_metrics_path[MAX_PATH_SIZE];
+module_param_string(pm_metrics, pm_metrics_path, MAX_PATH_SIZE, 0444);
+MODULE_PARM_DESC(pm_metrics,
+	"Path to pm_metrics, exported in debugfs. "
+	"(Empty): Disabled. "
+	"Default: (Empty)");
+
+static char partition_metrics_path[MAX_PATH_SIZE];
+module_param_string(partition_metrics, partition_metrics_path, MAX_PATH_SIZE, 0444);
+MODULE_PARM_DESC(partition_metrics,
+	"Path to partition (XCP) metrics, exported in debugfs. "
+	"(Empty): Disabled. "
+	"Default: (Empty)");
+
 #define MAX_HWMON_NAME 32
 #define DEFAULT_PER_CORE_HWMON_NAME "cpu_thermal"
 static char per_core_hwmon_name[MAX_HWMON_NAME] = DEFAULT_PER_CORE_HWMON_NAME;
@@ -63,8 +102,266 @@ MODULE_PARM_DESC(per_core_hwmon,
 	"(Empty): Merge into the main HWMON device. "
 	"Default: " DEFAULT_PER_CORE_HWMON_NAME);
 
-#define UPDATE_INTERVAL_MS 100
-#define UPDATE_INTERVAL_JIFFIES (UPDATE_INTERVAL_MS * HZ / 1000)
+#define DEFAULT_NPU_HWMON_NAME "amdgpu_npu"
+static char npu_hwmon_name[MAX_HWMON_NAME] = DEFAULT_NPU_HWMON_NAME;
+module_param_string(npu_hwmon, npu_hwmon_name, MAX_HWMON_NAME, 0444);
+MODULE_PARM_DESC(npu_hwmon,
+	"Name of NPU (IPU) HWMON device. "
+	"(Empty): Merge into the main HWMON device. "
+	"Default: " DEFAULT_NPU_HWMON_NAME);
+
+/* Channel groups that can be picked with channel_groups */
+enum amdgpu_metrics_channel_group {
+	cg_temp,
+	cg_power,
+	cg_freq,
+	cg_in,
+	cg_curr,
+	cg_fan,
+	cg_activity,
+	cg_bandwidth,
+	cg_util,
+	cg_link,
+	cg_pcie_error,
+	cg_throttle,
+	cg_throttler,
+	cg_headroom,
+	cg_xcc,
+	cg_vcn,
+	cg_jpeg,
+	cg_time_in_state,
+	NCHANNEL_GROUPS,
+};
+
+/* Also the prefixes of their attributes */
+static const char * const amdgpu_metrics_channel_group_names[NCHANNEL_GROUPS] = {
+	[cg_temp] = "temp",
+	[cg_power] = "power",
+	[cg_freq] = "freq",
+	[cg_in] = "in",
+	[cg_curr] = "curr",
+	[cg_fan] = "fan",
+	[cg_activity] = "activity",
+	[cg_bandwidth] = "bandwidth",
+	[cg_util] = "util",
+	[cg_link] = "link",
+	[cg_pcie_error] = "pcie_error",
+	[cg_throttle] = "throttle",
+	[cg_throttler] = "throttler",
+	[cg_headroom] = "headroom",
+	[cg_xcc] = "xcc",
+	[cg_vcn] = "vcn",
+	[cg_jpeg] = "jpeg",
+	[cg_time_in_state] = "time_in_state",
+};
+
+#define MAX_CHANNEL_GROUPS_SIZE 256
+static char channel_groups[MAX_CHANNEL_GROUPS_SIZE];
+module_param_string(channel_groups, channel_groups, MAX_CHANNEL_GROUPS_SIZE, 0444);
+MODULE_PARM_DESC(channel_groups,
+	"Comma-separated channel groups to register and decode, e.g., \"temp,power,freq\". "
+	"(Empty): All. "
+	"Default: (Empty)");
+
+/* Parsed from channel_groups */
+static unsigned long amdgpu_metrics_channel_groups_mask = GENMASK(NCHANNEL_GROUPS - 1, 0);
+
+static bool amdgpu_metrics_channel_group_enabled(enum amdgpu_metrics_channel_group group)
+{
+	return amdgpu_metrics_channel_groups_mask & BIT(group);
+}
+
+static int __init amdgpu_metrics_channel_groups_parse(void)
+{
+	char *buf, *p, *name;
+	int i, err = 0;
+
+	if (channel_groups[0] == '\0')
+		return 0;
+
+	/* Keep the parameter intact for sysfs. */
+	buf = kstrdup(channel_groups, GFP_KERNEL);
+	if (buf == NULL)
+		return -ENOMEM;
+
+	amdgpu_metrics_channel_groups_mask = 0;
+
+	p = buf;
+	while ((name = strsep(&p, ",")) != NULL) {
+		name = strim(name);
+		if (*name == '\0')
+			continue;
+
+		i = match_string(amdgpu_metrics_channel_group_names, NCHANNEL_GROUPS, name);
+		if (i < 0) {
+			pr_err("Unknown channel group: %s\n", name);
+			err = -EINVAL;
+			break;
+		}
+
+		amdgpu_metrics_channel_groups_mask |= BIT(i);
+	}
+
+	kfree(buf);
+	return err;
+}
+
+static bool thermal_zones;
+module_param(thermal_zones, bool, 0444);
+MODULE_PARM_DESC(thermal_zones,
+	"Register thermal zones for Edge, Hotspot, SoC and per-CPU-core temperatures. "
+	"Default: false");
+
+#define DEFAULT_THERMAL_POLLING_MS 1000
+static unsigned int thermal_polling_ms = DEFAULT_THERMAL_POLLING_MS;
+module_param(thermal_polling_ms, uint, 0444);
+MODULE_PARM_DESC(thermal_polling_ms,
+	"Polling interval of thermal zones in ms. "
+	"(0): Only poll on demand. "
+	"Default: " __stringify(DEFAULT_THERMAL_POLLING_MS));
+
+static bool iio;
+module_param(iio, bool, 0444);
+MODULE_PARM_DESC(iio,
+	"Register an IIO device with a triggered buffer. "
+	"Default: false");
+
+static unsigned int sample_interval_ms;
+module_param(sample_interval_ms, uint, 0444);
+MODULE_PARM_DESC(sample_interval_ms,
+	"Refresh gpu_metrics in the background every N ms. "
+	"(0): Only refresh on demand. "
+	"Default: 0");
+
+static unsigned int history_depth;
+module_param(history_depth, uint, 0444);
+MODULE_PARM_DESC(history_depth,
+	"Number of recent gpu_metrics snapshots kept in the flight recorder (debugfs). "
+	"(0): Disabled. "
+	"Default: 0");
+
+static unsigned int history_keyframe_interval = 64;
+module_param(history_keyframe_interval, uint, 0444);
+MODULE_PARM_DESC(history_keyframe_interval,
+	"Record a full snapshot every N snapshots in the flight recorder, "
+	"others are recorded as deltas against the previous one. "
+	"(0 or 1): Only record full snapshots. "
+	"Default: 64");
+
+static unsigned int history_kb;
+module_param(history_kb, uint, 0444);
+MODULE_PARM_DESC(history_kb,
+	"Memory for the flight recorder of each device in KiB. "
+	"(0): Estimate from history_depth. "
+	"Default: 0");
+
+static unsigned int history_freeze_temp;
+module_param(history_freeze_temp, uint, 0644);
+MODULE_PARM_DESC(history_freeze_temp,
+	"Freeze the flight recorder once any temperature reaches N milli-Celsius. "
+	"(0): Disabled. "
+	"Default: 0");
+
+static unsigned int history_freeze_power;
+module_param(history_freeze_power, uint, 0644);
+MODULE_PARM_DESC(history_freeze_power,
+	"Freeze the flight recorder once the socket power reaches N micro-Watts. "
+	"(0): Disabled. "
+	"Default: 0");
+
+static unsigned int smu_read_rate;
+module_param(smu_read_rate, uint, 0644);
+MODULE_PARM_DESC(smu_read_rate,
+	"Limit reads of gpu_metrics from all devices to N per second. "
+	"Throttled readers get the cached snapshot. "
+	"(0): Unlimited. "
+	"Default: 0");
+
+static unsigned int smu_read_burst = 4;
+module_param(smu_read_burst, uint, 0644);
+MODULE_PARM_DESC(smu_read_burst,
+	"Allow bursts of up to N reads of gpu_metrics beyond smu_read_rate. "
+	"Default: 4");
+
+static unsigned int pcie_error_rate_alarm;
+module_param(pcie_error_rate_alarm, uint, 0644);
+MODULE_PARM_DESC(pcie_error_rate_alarm,
+	"Raise the alarm of a PCIe link error counter once it increases by N or more per second. "
+	"(0): Disabled. "
+	"Default: 0");
+
+#define NTIME_IN_STATE_BUCKETS 16
+static unsigned int time_in_state_mhz[NTIME_IN_STATE_BUCKETS] = {
+	400, 800, 1200, 1600, 2000, 2400, 2800, 3200, 3600, 4000, 4400, 4800,
+};
+static unsigned int time_in_state_nbuckets = 12;
+module_param_array(time_in_state_mhz, uint, &time_in_state_nbuckets, 0444);
+MODULE_PARM_DESC(time_in_state_mhz,
+	"Ascending bucket boundaries of the time_in_state statistics in MHz, up to "
+	__stringify(NTIME_IN_STATE_BUCKETS) ". "
+	"Only collected with sample_interval_ms. "
+	"Default: 400,800,...,4800");
+
+/* Utilizations derived from busy_acc, XCPs average their XCCs */
+static const char *amdgpu_metrics_labels_util[] = {
+	"GFX", "UMC",
+	"XCP 0", "XCP 1", "XCP 2", "XCP 3",
+	"XCP 4", "XCP 5", "XCP 6", "XCP 7",
+};
+#define NCHANNELS_UTIL (ARRAY_SIZE(amdgpu_metrics_labels_util)) /* 10 */
+#define UTIL_XCP0 2
+
+/* Clock domains of time_in_state */
+enum amdgpu_metrics_time_in_state_domain {
+	tis_gfxclk,
+	tis_socclk,
+	tis_uclk,
+	tis_fclk,
+	tis_coreclk, /* The fastest core */
+	NTIME_IN_STATE_DOMAINS,
+};
+
+/* Tables read along with gpu_metrics, see pm_metrics and partition_metrics */
+enum amdgpu_metrics_companion {
+	companion_pm_metrics,
+	companion_partition_metrics,
+	NCOMPANIONS,
+};
+
+/* structure_size of both headers is 16-bit. */
+#define COMPANION_MAX_SIZE U16_MAX
+
+static const struct {
+	const char *name;
+	const char *path;
+	size_t min_size; /* Of the header */
+} amdgpu_metrics_companions[NCOMPANIONS] = {
+	[companion_pm_metrics] = {
+		.name = "pm_metrics",
+		.path = pm_metrics_path,
+		.min_size = sizeof(struct amdgpu_pmmetrics_header),
+	},
+	[companion_partition_metrics] = {
+		.name = "partition_metrics",
+		.path = partition_metrics_path,
+		.min_size = sizeof(struct metrics_table_header),
+	},
+};
+
+/* Latency of reading gpu_metrics, bucket i counts [2^i, 2^(i+1)) ns */
+#define NLATENCY_BUCKETS 32
+
+/* Per-CPU, so that they're cheap enough to be always enabled. */
+struct amdgpu_metrics_stats {
+	u64 reads;		/* HWMON reads served */
+	u64 refreshes;		/* Refreshes triggered */
+	u64 skipped;		/* Refreshes skipped by UPDATE_INTERVAL_MS */
+	u64 errors;		/* Failed refreshes */
+	u64 companion_errors;	/* Failed reads of companion tables */
+	u64 throttled;		/* Refreshes throttled by smu_read_rate */
+	u64 lock_wait_ns;	/* Time readers spent waiting on metrics_lock */
+	u64 latency[NLATENCY_BUCKETS];
+};
 
 struct amdgpu_metrics_private {
 	struct amdgpu_metrics_private_common common;
@@ -72,16 +369,205 @@ struct amdgpu_metrics_private {
 	/*  */
 	remap_t per_core_channel_remap[NCORES];
 
-	struct rw_semaphore metrics_lock;
-	unsigned long last_update_jiffies;
+	struct amdgpu_metrics_refresh refresh;
+
+	struct amdgpu_metrics_stats __percpu *stats;
+
+	/* Protected by metrics_lock, rates of accumulators in the last interval */
+	struct {
+		u32 prev_counter;
+		u32 prev_throttle[NCHANNELS_THROTTLE];
+		u32 throttle[NCHANNELS_THROTTLE]; /* milli-percent */
+		u64 prev_busy[NCHANNELS_BUSY_ACC];
+		u32 util[NCHANNELS_UTIL]; /* milli-percent */
+		u32 xcc_util[NXCP][NXCC]; /* milli-percent */
+		bool has_prev;
+		bool has_rates;
+	} acc;
+
+	/* Protected by metrics_lock, throughputs of links in the last interval */
+	struct {
+		u64 prev_timestamp;
+		u64 prev_read[NCHANNELS_LINK];
+		u64 prev_write[NCHANNELS_LINK];
+		u64 read[NCHANNELS_LINK]; /* B/s */
+		u64 write[NCHANNELS_LINK]; /* B/s */
+		u64 prev_error[NCHANNELS_PCIE_ERROR];
+		u64 error_rate[NCHANNELS_PCIE_ERROR]; /* milli-Hz */
+		u32 error_alarm; /* Error counters over pcie_error_rate_alarm */
+		u32 error_alarm_changed; /* Bits changed by the last refresh */
+		bool has_prev;
+		bool has_rates;
+	} link;
+
+	/* Protected by metrics_lock, headroom of the socket power below its cap */
+	struct {
+		s64 headroom; /* micro-Watts, negative if over the cap */
+		bool valid;
+	} power;
+
+	/*
+	 * Protected by metrics_lock, time spent (in ns) below each boundary of
+	 * time_in_state_mhz, and above all of them.
+	 */
+	struct {
+		u64 prev_counter;
+		u64 time[NTIME_IN_STATE_DOMAINS][NTIME_IN_STATE_BUCKETS + 1];
+		bool has_prev;
+	} time_in_state;
+
+	/* Protected by metrics_lock, NULL buf if disabled */
+	struct amdgpu_metrics_companion_table {
+		struct amdgpu_metrics_private *priv;
+		void *buf;
+		size_t capacity; /* The size of the first read */
+		size_t size; /* 0 if the last read failed */
+		u64 generation; /* Of the gpu_metrics read along */
+	} companions[NCOMPANIONS];
+
+	/* Protected by metrics_lock */
+	struct {
+		u64 status; /* indep_throttle_status */
+		u64 changed; /* Bits changed by the last refresh */
+		bool valid;
+	} throttler;
+
+	/* Attributes of optional channel groups, created for each device */
+	struct amdgpu_metrics_ext_attr *ext_attrs;
+	unsigned int n_ext_attrs;
+	size_t ext_attr_bytes; /* Of all HWMON devices, see "memory" in debugfs */
+	struct attribute_group ext_attrgroup;
+	const struct attribute_group *attrgroups[4];
+
+	/* Attributes of the NPU HWMON device */
+	struct attribute_group npu_attrgroup;
+	const struct attribute_group *npu_attrgroups[2];
+
+	/* Attributes of the per-CPU-core HWMON device */
+	struct attribute_group per_core_attrgroup;
+	const struct attribute_group *per_core_attrgroups[2];
+
+	/* Child HWMON devices of the active partitions (XCPs) */
+	struct amdgpu_metrics_xcp {
+		struct device *hwmon_dev;
+		struct attribute_group ext_attrgroup;
+		const struct attribute_group *attrgroups[2];
+	} xcp[NXCP];
+
+	/* Protected by metrics_lock, channels read at once from "bulk" */
+	struct {
+		struct amdgpu_metrics_selected {
+			u8 type; /* enum hwmon_sensor_types */
+			u8 channel;
+		} channels[NCHANNELS_TEMP + NCHANNELS_POWER + NCHANNELS_FREQ +
+			   NCHANNELS_IN + NCHANNELS_CURR + NCHANNELS_FAN];
+		unsigned int count;
+	} select;
+
+	struct device *hwmon_dev;
+	struct delayed_work sample_work;
+	struct dentry *debugfs_dir;
+
+	/* Protected by metrics_lock */
+	struct {
+		/* The last recorded snapshot, deltas are encoded against it */
+		void *prev;
+		/*
+		 * Records are stored back to back from tail to head. If a record
+		 * doesn't fit before the end of the ring, it wraps to the beginning,
+		 * and records before the wrap end at wrap.
+		 */
+		void *ring;
+		size_t capacity;
+		size_t head;
+		size_t tail;
+		size_t wrap;
+		unsigned int depth;
+		unsigned int count;
+		unsigned int since_keyframe;
+		/* Written from debugfs without metrics_lock */
+		bool frozen;
+	} history;
+};
+
+/*
+ * Optional channel groups that HWMON has no sensor type for. Their attributes
+ * are named <prefix><channel + 1>_<kind> and <prefix><channel + 1>_label, and
+ * only created for the channels and kinds a device has.
+ *
+ * Groups of partitions are instantiated for each of them, and their callbacks
+ * get instance * nchannels + channel.
+ */
+struct amdgpu_metrics_ext_group {
+	const char *prefix;
+	const char **labels;
+	/* Optional, overrides labels */
+	const char *(*label)(const struct amdgpu_metrics_private *priv, unsigned int channel);
+	unsigned int nchannels;
+	const char * const *kinds;
+	unsigned int nkinds;
+	bool (*is_visible)(const struct amdgpu_metrics_private *priv, unsigned int channel,
+			   unsigned int kind);
+	/* Called with metrics_lock held for reading */
+	int (*read)(struct amdgpu_metrics_private *priv, unsigned int channel, unsigned int kind,
+		    s64 *val);
+	/* Optional, called with metrics_lock held for writing after each refresh */
+	bool (*changed)(const struct amdgpu_metrics_private *priv, unsigned int channel,
+			unsigned int kind);
+};
+
+#define EXT_KIND_LABEL U8_MAX
+
+struct amdgpu_metrics_ext_attr {
+	struct device_attribute dev_attr;
+	const struct amdgpu_metrics_ext_group *group;
+	u16 channel; /* Including the instance */
+	u8 kind;
+	char name[32];
 };
 
-/* A magical thief stole something from HWMON... */
+/*
+ * A magical thief stole something from HWMON... Frequencies are exported as
+ * ext groups, but read, selected and traced like the other sensor types.
+ */
 #define hwmon_magic_freq	/* enum hwmon_sensor_types */	hwmon_intrusion
 #define hwmon_magic_freq_input		/* u32 */		0x8D8D8D8D
-#define hwmon_magic_freq_label		/* u32 */		0x0D0D0D0D
-#define hwmon_magic_freq_idx_main	/* u8 */		0x8D
-#define hwmon_magic_freq_idx_per_core	/* u8 */		0x0D
+
+/* The channel group of a sensor type, NCHANNEL_GROUPS if none */
+static enum amdgpu_metrics_channel_group
+amdgpu_metrics_hwmon_channel_group(enum hwmon_sensor_types type)
+{
+	switch (type) {
+	case hwmon_temp:
+		return cg_temp;
+	case hwmon_power:
+		return cg_power;
+	case hwmon_magic_freq:
+		return cg_freq;
+	case hwmon_in:
+		return cg_in;
+	case hwmon_curr:
+		return cg_curr;
+	case hwmon_fan:
+		return cg_fan;
+	default:
+		return NCHANNEL_GROUPS;
+	}
+}
+
+static bool amdgpu_metrics_hwmon_type_enabled(enum hwmon_sensor_types type)
+{
+	enum amdgpu_metrics_channel_group group = amdgpu_metrics_hwmon_channel_group(type);
+
+	return group < NCHANNEL_GROUPS && amdgpu_metrics_channel_group_enabled(group);
+}
+
+static channel_t amdgpu_metrics_power_cap_channel(const struct amdgpu_metrics_private *priv,
+						  u32 attr)
+{
+	return attr == hwmon_power_cap ? priv->common.channels->power_cap
+				       : priv->common.channels->power_cap_max;
+}
 
 static umode_t amdgpu_metrics_hwmon_is_visible(const void *drvdata,
 					       enum hwmon_sensor_types type,
@@ -89,11 +575,20 @@ static umode_t amdgpu_metrics_hwmon_is_visible(const void *drvdata,
 {
 	struct amdgpu_metrics_private *priv = (struct amdgpu_metrics_private *)drvdata;
 	bool visible = false;
+	uint64_t val;
+
+	if (!amdgpu_metrics_hwmon_type_enabled(type))
+		return 0;
 
 	if (type == hwmon_temp)
 		visible = (channel < NCHANNELS_TEMP &&
 			   priv->common.remap.temp.data[channel].valid &&
 			   !priv->common.remap.temp.data[channel].ext);
+	else if (type == hwmon_power && (attr == hwmon_power_cap || attr == hwmon_power_cap_max))
+		visible = (channel == REMAP_IDX(power, socket) &&
+			   !amdgpu_metrics_get_opt_val(&priv->common,
+						       amdgpu_metrics_power_cap_channel(priv, attr),
+						       &val));
 	else if (type == hwmon_power)
 		visible = (channel < NCHANNELS_POWER &&
 			   priv->common.remap.power.data[channel].valid &&
@@ -102,6 +597,15 @@ static umode_t amdgpu_metrics_hwmon_is_visible(const void *drvdata,
 		visible = (channel < NCHANNELS_FREQ &&
 			   priv->common.remap.freq.data[channel].valid &&
 			   !priv->common.remap.freq.data[channel].ext);
+	else if (type == hwmon_in)
+		visible = (channel < NCHANNELS_IN &&
+			   priv->common.remap.in.data[channel].valid);
+	else if (type == hwmon_curr)
+		visible = (channel < NCHANNELS_CURR &&
+			   priv->common.remap.curr.data[channel].valid);
+	else if (type == hwmon_fan)
+		visible = (channel < NCHANNELS_FAN &&
+			   priv->common.remap.fan.data[channel].valid);
 
 	return visible ? 0444 : 0;
 }
@@ -113,434 +617,2704 @@ static umode_t amdgpu_metrics_per_core_is_visible(const void *drvdata,
 	struct amdgpu_metrics_private *priv = (struct amdgpu_metrics_private *)drvdata;
 	bool visible = false;
 
-	if (WARN_ON(channel >= NCORES) ||
-	    !priv->per_core_channel_remap[channel].valid)
+	if (WARN_ON(channel >= NCORES) ||
+	    !priv->per_core_channel_remap[channel].valid ||
+	    !amdgpu_metrics_hwmon_type_enabled(type))
+		goto out;
+
+	channel = priv->per_core_channel_remap[channel].idx;
+
+	if (type == hwmon_temp)
+		visible = priv->common.remap.temp.core[channel].valid;
+	else if (type == hwmon_power)
+		visible = priv->common.remap.power.core[channel].valid;
+	else if (type == hwmon_magic_freq)
+		visible = priv->common.remap.freq.coreclk[channel].valid;
+
+out:
+	return visible ? 0444 : 0;
+}
+
+static int amdgpu_metrics_hwmon_read_string(struct device *dev, enum hwmon_sensor_types type,
+					    u32 attr, int channel, const char **str)
+{
+	struct amdgpu_metrics_private *priv = dev_get_drvdata(dev);
+
+	if (type == hwmon_temp && attr == hwmon_temp_label)
+		*str = amdgpu_metrics_labels_temp[priv->common.remap.temp.data[channel].idx];
+	else if (type == hwmon_power && attr == hwmon_power_label)
+		*str = amdgpu_metrics_labels_power[priv->common.remap.power.data[channel].idx];
+	else if (type == hwmon_in && attr == hwmon_in_label)
+		*str = amdgpu_metrics_labels_in[priv->common.remap.in.data[channel].idx];
+	else if (type == hwmon_curr && attr == hwmon_curr_label)
+		*str = amdgpu_metrics_labels_curr[priv->common.remap.curr.data[channel].idx];
+	else if (type == hwmon_fan && attr == hwmon_fan_label)
+		*str = amdgpu_metrics_labels_fan[priv->common.remap.fan.data[channel].idx];
+	else
+		return -EOPNOTSUPP;
+
+	return 0;
+}
+
+/* Companions are read on every refresh, don't flood the log with their failures. */
+#define amdgpu_metrics_table_err(_ratelimited, fmt, ...)	\
+do {								\
+	if (_ratelimited)					\
+		pr_err_ratelimited(fmt, ##__VA_ARGS__);		\
+	else							\
+		pr_err(fmt, ##__VA_ARGS__);			\
+} while (0)
+
+/*
+ * Both metrics_table_header and amdgpu_pmmetrics_header start with the 16-bit
+ * structure_size, which must match what was read.
+ *
+ * @ratelimited: for tables read on every refresh whose failures aren't fatal
+ */
+static ssize_t amdgpu_metrics_read_table(const char *path, const char *what, void *buf,
+					 size_t buf_size, size_t min_size, bool ratelimited)
+{
+	struct file *filp;
+	ssize_t ret;
+
+	filp = filp_open(path, O_RDONLY, 0);
+	if (IS_ERR(filp)) {
+		amdgpu_metrics_table_err(ratelimited, "Failed to open %s\n", path);
+		return PTR_ERR(filp);
+	}
+
+	ret = kernel_read(filp, buf, buf_size, NULL);
+	filp_close(filp, NULL);
+
+	if (ret < 0) {
+		amdgpu_metrics_table_err(ratelimited, "Failed to read %s: %zd\n", what, ret);
+		return ret;
+	}
+
+	if (ret < min_size) {
+		amdgpu_metrics_table_err(ratelimited, "Invalid %s size: %zd < %zu\n", what, ret,
+					 min_size);
+		return -EIO;
+	}
+
+	if (ret != *(u16 *)buf) {
+		amdgpu_metrics_table_err(ratelimited, "%s size mismatch: read %zd, declared %u\n",
+					 what, ret, *(u16 *)buf);
+		return -EIO;
+	}
+
+	return ret;
+}
+
+static ssize_t amdgpu_metrics_read_gpu_metrics(const char *path,
+					       struct metrics_table_header *metrics,
+					       size_t buf_size)
+{
+	/* Tests feed data/sample instead. */
+	KUNIT_STATIC_STUB_REDIRECT(amdgpu_metrics_read_gpu_metrics, path, metrics, buf_size);
+
+	return amdgpu_metrics_read_table(path, "GPU metrics", metrics, buf_size,
+					 sizeof(struct metrics_table_header), false);
+}
+
+/* Must be called with metrics_lock held for writing. */
+static void amdgpu_metrics_read_companions(struct amdgpu_metrics_private *priv)
+{
+	ssize_t size;
+	int i;
+
+	for (i = 0; i < NCOMPANIONS; i++) {
+		if (!priv->companions[i].buf)
+			continue;
+
+		size = amdgpu_metrics_read_table(amdgpu_metrics_companions[i].path,
+						 amdgpu_metrics_companions[i].name,
+						 priv->companions[i].buf,
+						 priv->companions[i].capacity,
+						 amdgpu_metrics_companions[i].min_size, true);
+		if (size < 0) {
+			this_cpu_inc(priv->stats->companion_errors);
+			priv->companions[i].size = 0;
+			continue;
+		}
+
+		priv->companions[i].size = size;
+		priv->companions[i].generation = priv->refresh.generation;
+	}
+}
+
+/*
+ * Temp: centi-Celsius to milli-Celsius
+ * Power: mW to uW
+ * Freq: MHz to Hz
+ */
+#define GET_MULTIPLIER(_hwmon_type)			\
+	((_hwmon_type) == hwmon_temp ? 10 :		\
+	 (_hwmon_type) == hwmon_power ? 1000 :		\
+	 (_hwmon_type) == hwmon_in ? 1 :		\
+	 (_hwmon_type) == hwmon_curr ? 1 :		\
+	 (_hwmon_type) == hwmon_fan ? 1 :		\
+	 (_hwmon_type) == hwmon_magic_freq ? 1000000 :	\
+	 0)
+
+/* Must be called with metrics_lock held for writing. */
+static bool amdgpu_metrics_history_should_freeze(struct amdgpu_metrics_private *priv)
+{
+	unsigned int freeze_temp = READ_ONCE(history_freeze_temp);
+	unsigned int freeze_power = READ_ONCE(history_freeze_power);
+	uint64_t raw;
+	unsigned int i;
+
+	if (freeze_power &&
+	    !GET_POWER(&priv->common, REMAP_IDX(power, socket), &raw) &&
+	    raw * GET_MULTIPLIER(hwmon_power) >= freeze_power)
+		return true;
+
+	if (!freeze_temp)
+		return false;
+
+	for (i = 0; i < NCHANNELS_TEMP; i++) {
+		if (priv->common.remap.temp.data[i].valid &&
+		    !GET_TEMP(&priv->common, i, &raw) &&
+		    raw * GET_MULTIPLIER(hwmon_temp) >= freeze_temp)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Drop the oldest record, and the deltas following it, which can't be decoded
+ * without it. Must be called with metrics_lock held for writing.
+ */
+static void amdgpu_metrics_history_evict(struct amdgpu_metrics_private *priv)
+{
+	const struct amdgpu_metrics_history_record *record;
+
+	do {
+		record = priv->history.ring + priv->history.tail;
+		priv->history.tail += AMDGPU_METRICS_HISTORY_RECORD_SIZE(record->size);
+		if (priv->history.tail == priv->history.wrap) {
+			priv->history.tail = 0;
+			priv->history.wrap = priv->history.capacity;
+		}
+		priv->history.count--;
+		record = priv->history.ring + priv->history.tail;
+	} while (priv->history.count && record->kind == history_delta);
+}
+
+/*
+ * Evict records until @size bytes are available at head.
+ * Must be called with metrics_lock held for writing.
+ */
+static void amdgpu_metrics_history_make_room(struct amdgpu_metrics_private *priv, size_t size)
+{
+	while (priv->history.count >= priv->history.depth)
+		amdgpu_metrics_history_evict(priv);
+
+	while (priv->history.count) {
+		if (priv->history.tail < priv->history.head) {
+			if (priv->history.head + size <= priv->history.capacity)
+				return;
+			priv->history.wrap = priv->history.head;
+			priv->history.head = 0;
+		} else if (priv->history.head + size <= priv->history.tail) {
+			return;
+		} else {
+			amdgpu_metrics_history_evict(priv);
+		}
+	}
+
+	priv->history.head = priv->history.tail = 0;
+	priv->history.wrap = priv->history.capacity;
+}
+
+/* Must be called with metrics_lock held for writing. */
+static void amdgpu_metrics_history_record(struct amdgpu_metrics_private *priv)
+{
+	struct amdgpu_metrics_history_record *record;
+	uint16_t size = priv->common.channels->metrics_size;
+	const void *cur = priv->common.metrics;
+	bool keyframe;
+	size_t payload_size = size;
+
+	if (READ_ONCE(priv->history.frozen))
+		return;
+
+	keyframe = !priv->history.count ||
+		   priv->history.since_keyframe + 1 >= history_keyframe_interval;
+	if (!keyframe) {
+		payload_size = amdgpu_metrics_history_delta_encode(NULL, priv->history.prev, cur,
+								   size);
+		keyframe = payload_size >= size;
+	}
+	if (keyframe)
+		payload_size = size;
+
+	amdgpu_metrics_history_make_room(priv, AMDGPU_METRICS_HISTORY_RECORD_SIZE(payload_size));
+	/* Evicting dropped the base of this delta. */
+	if (!keyframe && !priv->history.count) {
+		keyframe = true;
+		payload_size = size;
+		amdgpu_metrics_history_make_room(priv,
+						 AMDGPU_METRICS_HISTORY_RECORD_SIZE(payload_size));
+	}
+
+	record = priv->history.ring + priv->history.head;
+	*record = (struct amdgpu_metrics_history_record) {
+		.timestamp_ns = ktime_get_ns(),
+		.seq = priv->refresh.generation,
+		.size = payload_size,
+		.kind = keyframe ? history_keyframe : history_delta,
+	};
+	if (keyframe)
+		memcpy(record + 1, cur, size);
+	else
+		amdgpu_metrics_history_delta_encode(record + 1, priv->history.prev, cur, size);
+	memcpy(priv->history.prev, cur, size);
+
+	priv->history.head += AMDGPU_METRICS_HISTORY_RECORD_SIZE(payload_size);
+	priv->history.count++;
+	priv->history.since_keyframe = keyframe ? 0 : priv->history.since_keyframe + 1;
+
+	if (amdgpu_metrics_history_should_freeze(priv)) {
+		WRITE_ONCE(priv->history.frozen, true);
+		/* hwmon_dev isn't set yet while taking the first snapshots. */
+		pr_info("Flight recorder of %s frozen\n", priv->path);
+	}
+}
+
+/*
+ * Each read of gpu_metrics costs SMU time, so all devices and all readers share
+ * a single budget. It is a token bucket, implemented as GCRA: tat is the
+ * theoretical arrival time of the next read.
+ */
+static struct {
+	spinlock_t lock;
+	u64 tat;
+	u64 granted;
+	u64 throttled;
+} amdgpu_metrics_budget = {
+	.lock = __SPIN_LOCK_UNLOCKED(amdgpu_metrics_budget.lock),
+};
+
+/* @take: false to only check whether a read would be granted */
+static bool amdgpu_metrics_budget_take(bool take)
+{
+	unsigned int rate = READ_ONCE(smu_read_rate);
+	unsigned int burst = max(READ_ONCE(smu_read_burst), 1U);
+	u64 now, interval;
+
+	if (!rate)
+		return true;
+
+	interval = div_u64(NSEC_PER_SEC, rate);
+	now = ktime_get_ns();
+
+	guard(spinlock)(&amdgpu_metrics_budget.lock);
+
+	amdgpu_metrics_budget.tat = max(amdgpu_metrics_budget.tat, now);
+	if (amdgpu_metrics_budget.tat - now > interval * (burst - 1)) {
+		amdgpu_metrics_budget.throttled++;
+		return false;
+	}
+
+	if (take) {
+		amdgpu_metrics_budget.tat += interval;
+		amdgpu_metrics_budget.granted++;
+	}
+	return true;
+}
+
+/* Accumulators wrap around at their width. */
+static u64 amdgpu_metrics_acc_delta(channel_t channel, u64 cur, u64 prev)
+{
+	return channel.type == channel_u64 ? cur - prev : (u32)(cur - prev);
+}
+
+/*
+ * Derive the throttled and busy percentages in the last interval from the
+ * accumulators, with the accumulation counter as the time base. The SMU may not
+ * have accumulated since the last refresh, in which case the last percentages
+ * are kept.
+ *
+ * Must be called with metrics_lock held for writing.
+ */
+static void amdgpu_metrics_acc_update(struct amdgpu_metrics_private *priv)
+{
+	const struct amdgpu_metrics_def *channels = priv->common.channels;
+	const struct amdgpu_metrics_labels_remap *remap = &priv->common.remap;
+	uint64_t counter, acc, sum[NCHANNELS_UTIL] = {};
+	unsigned int i, n[NCHANNELS_UTIL] = {};
+	u32 interval;
+
+	if (amdgpu_metrics_get_opt_val(&priv->common, channels->acc_counter, &counter))
+		return;
+
+	interval = (u32)counter - priv->acc.prev_counter;
+	if (priv->acc.has_prev && !interval)
+		return;
+
+	/* Residencies count accumulation cycles. */
+	for (i = 0; i < NCHANNELS_THROTTLE; i++) {
+		if (!remap->throttle.data[i].valid || GET_THROTTLE(&priv->common, i, &acc))
+			continue;
+
+		if (priv->acc.has_prev)
+			priv->acc.throttle[i] =
+				min_t(u64, div_u64(amdgpu_metrics_acc_delta(
+							channels->throttle.data[i], acc,
+							priv->acc.prev_throttle[i]) * 100000ULL,
+						   interval),
+				      100000);
+		priv->acc.prev_throttle[i] = acc;
+	}
+
+	/* Busy accumulators add up the busy percentage of each accumulation cycle. */
+	for (i = 0; i < NCHANNELS_BUSY_ACC; i++) {
+		unsigned int util = i < UTIL_XCP0 ? i : UTIL_XCP0 + (i - UTIL_XCP0) / NXCC;
+		u64 delta;
+
+		if (!remap->busy_acc.data[i].valid || GET_BUSY_ACC(&priv->common, i, &acc))
+			continue;
+
+		delta = amdgpu_metrics_acc_delta(channels->busy_acc.data[i], acc,
+						 priv->acc.prev_busy[i]);
+		if (priv->acc.has_prev && i >= UTIL_XCP0)
+			priv->acc.xcc_util[(i - UTIL_XCP0) / NXCC][(i - UTIL_XCP0) % NXCC] =
+				min_t(u64, div_u64(delta * 1000, interval), 100000);
+		sum[util] += delta;
+		n[util]++;
+		priv->acc.prev_busy[i] = acc;
+	}
+
+	for (i = 0; priv->acc.has_prev && i < NCHANNELS_UTIL; i++) {
+		if (n[i])
+			priv->acc.util[i] = min_t(u64, div64_u64(sum[i] * 1000,
+								 (u64)n[i] * interval),
+						  100000);
+	}
+
+	priv->acc.has_rates = priv->acc.has_prev;
+	priv->acc.has_prev = true;
+	priv->acc.prev_counter = counter;
+}
+
+/* Current clock of a time_in_state domain in MHz */
+static int amdgpu_metrics_time_in_state_freq(const struct amdgpu_metrics_private *priv,
+					     unsigned int domain, uint64_t *freq)
+{
+	static const u8 channels[] = {
+		[tis_gfxclk] = REMAP_IDX(freq, gfxclk[0]),
+		[tis_socclk] = REMAP_IDX(freq, socclk[0]),
+		[tis_uclk] = REMAP_IDX(freq, uclk),
+		[tis_fclk] = REMAP_IDX(freq, fclk),
+	};
+	const remap_t *remap = priv->common.remap.freq.data;
+	uint64_t core;
+	unsigned int i;
+	int err = -ENODEV;
+
+	if (domain != tis_coreclk)
+		return remap[channels[domain]].valid
+			? GET_FREQ(&priv->common, channels[domain], freq) : -ENODEV;
+
+	/* Cores of a CCX share their voltage, so the fastest one is what matters. */
+	*freq = 0;
+	for (i = 0; i < NCORES; i++) {
+		if (!priv->common.remap.freq.coreclk[i].valid ||
+		    GET_FREQ(&priv->common, REMAP_IDX(freq, coreclk[i]), &core))
+			continue;
+		*freq = max(*freq, core);
+		err = 0;
+	}
+
+	return err;
+}
+
+/*
+ * Accumulate the time since the last refresh into the bucket of the current
+ * clock of each domain, with system_clock_counter as the time base. Clocks are
+ * averaged over about the same interval, so this is only done with regular
+ * refreshes from the background sampler.
+ *
+ * Must be called with metrics_lock held for writing.
+ */
+static void amdgpu_metrics_time_in_state_update(struct amdgpu_metrics_private *priv)
+{
+	uint64_t counter, freq;
+	unsigned int domain, bucket;
+	u64 interval;
+
+	if (!sample_interval_ms ||
+	    amdgpu_metrics_get_opt_val(&priv->common, priv->common.channels->system_clock_counter,
+				       &counter))
+		return;
+
+	interval = counter - priv->time_in_state.prev_counter;
+	priv->time_in_state.prev_counter = counter;
+	if (!priv->time_in_state.has_prev) {
+		priv->time_in_state.has_prev = true;
+		return;
+	}
+
+	for (domain = 0; domain < NTIME_IN_STATE_DOMAINS; domain++) {
+		if (amdgpu_metrics_time_in_state_freq(priv, domain, &freq))
+			continue;
+
+		for (bucket = 0; bucket < time_in_state_nbuckets; bucket++) {
+			if (freq < time_in_state_mhz[bucket])
+				break;
+		}
+		priv->time_in_state.time[domain][bucket] += interval;
+	}
+}
+
+/*
+ * Derive the headroom of the socket power below the current STAPM limit.
+ *
+ * Must be called with metrics_lock held for writing.
+ */
+static void amdgpu_metrics_power_update(struct amdgpu_metrics_private *priv)
+{
+	uint64_t cap, power;
+
+	priv->power.valid =
+		!amdgpu_metrics_get_opt_val(&priv->common, priv->common.channels->power_cap,
+					    &cap) &&
+		!GET_POWER(&priv->common, REMAP_IDX(power, socket), &power);
+	if (priv->power.valid)
+		priv->power.headroom = ((s64)cap - (s64)power) * GET_MULTIPLIER(hwmon_power);
+}
+
+/*
+ * Derive the read and write throughput of each link in the last interval from
+ * the accumulated data sizes (in KB), and the rate of PCIe link errors, with
+ * the PMFW timestamp as the time base.
+ *
+ * Must be called with metrics_lock held for writing.
+ */
+static void amdgpu_metrics_link_update(struct amdgpu_metrics_private *priv)
+{
+	const struct amdgpu_metrics_def *channels = priv->common.channels;
+	unsigned int threshold = READ_ONCE(pcie_error_rate_alarm);
+	uint64_t timestamp, rd, wr, count;
+	u32 alarm = 0;
+	u64 interval_ns;
+	unsigned int i;
+
+	priv->link.error_alarm_changed = 0;
+
+	if (amdgpu_metrics_get_opt_val(&priv->common, channels->fw_timestamp, &timestamp))
+		return;
+
+	if (priv->link.has_prev && timestamp == priv->link.prev_timestamp)
+		return;
+
+	/* Start over if the timestamp went backwards, e.g., after a GPU reset. */
+	if (timestamp < priv->link.prev_timestamp)
+		priv->link.has_prev = false;
+
+	interval_ns = (timestamp - priv->link.prev_timestamp) * 10;
+
+	for (i = 0; i < NCHANNELS_LINK; i++) {
+		if (amdgpu_metrics_get_opt_val(&priv->common, channels->link.read_acc.data[i], &rd) ||
+		    amdgpu_metrics_get_opt_val(&priv->common, channels->link.write_acc.data[i], &wr))
+			continue;
+
+		if (priv->link.has_prev) {
+			priv->link.read[i] = mul_u64_u64_div_u64(rd - priv->link.prev_read[i],
+								 1000 * NSEC_PER_SEC, interval_ns);
+			priv->link.write[i] = mul_u64_u64_div_u64(wr - priv->link.prev_write[i],
+								  1000 * NSEC_PER_SEC, interval_ns);
+		}
+		priv->link.prev_read[i] = rd;
+		priv->link.prev_write[i] = wr;
+	}
+
+	for (i = 0; i < NCHANNELS_PCIE_ERROR; i++) {
+		if (!priv->common.remap.pcie_error.data[i].valid ||
+		    GET_PCIE_ERROR(&priv->common, i, &count))
+			continue;
+
+		if (priv->link.has_prev) {
+			priv->link.error_rate[i] = mul_u64_u64_div_u64(
+				amdgpu_metrics_acc_delta(channels->pcie_error.data[i], count,
+							 priv->link.prev_error[i]),
+				1000 * NSEC_PER_SEC, interval_ns);
+			if (threshold && priv->link.error_rate[i] >= threshold * 1000ULL)
+				alarm |= BIT(i);
+		}
+		priv->link.prev_error[i] = count;
+	}
+
+	if (priv->link.has_prev) {
+		priv->link.error_alarm_changed = priv->link.error_alarm ^ alarm;
+		priv->link.error_alarm = alarm;
+	}
+
+	priv->link.has_rates = priv->link.has_prev;
+	priv->link.has_prev = true;
+	priv->link.prev_timestamp = timestamp;
+}
+
+/*
+ * Track the bits of indep_throttle_status changed by the last refresh.
+ *
+ * Must be called with metrics_lock held for writing.
+ */
+static void amdgpu_metrics_throttler_update(struct amdgpu_metrics_private *priv)
+{
+	uint64_t status;
+
+	priv->throttler.changed = 0;
+
+	if (amdgpu_metrics_get_opt_val(&priv->common, priv->common.channels->indep_throttle_status,
+				       &status))
+		return;
+
+	if (priv->throttler.valid)
+		priv->throttler.changed = priv->throttler.status ^ status;
+	priv->throttler.status = status;
+	priv->throttler.valid = true;
+}
+
+/*
+ * Wake up pollers of the attributes of optional channel groups that changed
+ * with the last refresh.
+ *
+ * Must be called with metrics_lock held for writing.
+ */
+static void amdgpu_metrics_ext_notify(struct amdgpu_metrics_private *priv)
+{
+	struct amdgpu_metrics_ext_attr *attr;
+	unsigned int i;
+
+	for (i = 0; i < priv->n_ext_attrs; i++) {
+		attr = &priv->ext_attrs[i];
+		if (attr->kind == EXT_KIND_LABEL || attr->group->changed == NULL ||
+		    !attr->group->changed(priv, attr->channel, attr->kind))
+			continue;
+
+		sysfs_notify(&priv->hwmon_dev->kobj, NULL, attr->name);
+	}
+}
+
+/*
+ * Update what is derived from the latest snapshot, skipping what no enabled
+ * channel group needs. Must be called with metrics_lock held for writing.
+ */
+static void amdgpu_metrics_derived_update(struct amdgpu_metrics_private *priv)
+{
+	if (amdgpu_metrics_channel_group_enabled(cg_util) ||
+	    amdgpu_metrics_channel_group_enabled(cg_throttle) ||
+	    amdgpu_metrics_channel_group_enabled(cg_xcc))
+		amdgpu_metrics_acc_update(priv);
+	if (amdgpu_metrics_channel_group_enabled(cg_headroom))
+		amdgpu_metrics_power_update(priv);
+	if (amdgpu_metrics_channel_group_enabled(cg_link) ||
+	    amdgpu_metrics_channel_group_enabled(cg_pcie_error))
+		amdgpu_metrics_link_update(priv);
+	if (amdgpu_metrics_channel_group_enabled(cg_throttler))
+		amdgpu_metrics_throttler_update(priv);
+	if (amdgpu_metrics_channel_group_enabled(cg_time_in_state))
+		amdgpu_metrics_time_in_state_update(priv);
+}
+
+static void amdgpu_metrics_refresh_skipped(void *data)
+{
+	struct amdgpu_metrics_private *priv = data;
+
+	this_cpu_inc(priv->stats->skipped);
+}
+
+static bool amdgpu_metrics_refresh_admit(void *data, bool take)
+{
+	struct amdgpu_metrics_private *priv = data;
+
+	/* Serve the cached snapshot instead. */
+	if (!amdgpu_metrics_budget_take(take)) {
+		this_cpu_inc(priv->stats->throttled);
+		return false;
+	}
+
+	return true;
+}
+
+static int amdgpu_metrics_refresh_update(void *data, bool force)
+{
+	struct amdgpu_metrics_private *priv = data;
+	ssize_t size;
+	u64 start, duration;
+	int err = 0;
+
+	trace_amdgpu_metrics_refresh_start(priv->path, force);
+	start = ktime_get_ns();
+
+	size = amdgpu_metrics_read_gpu_metrics(priv->path, &priv->common.metrics->header,
+					       priv->common.channels->metrics_size);
+	if (size < 0)
+		err = size;
+	else if (size != priv->common.channels->metrics_size)
+		err = -EIO;
+
+	duration = ktime_get_ns() - start;
+	trace_amdgpu_metrics_refresh_end(priv->path, &priv->common.metrics->header, size, err,
+					 duration);
+
+	this_cpu_inc(priv->stats->refreshes);
+	this_cpu_inc(priv->stats->latency[min(ilog2(duration | 1), NLATENCY_BUCKETS - 1)]);
+	if (err)
+		this_cpu_inc(priv->stats->errors);
+
+	return err;
+}
+
+static void amdgpu_metrics_refresh_updated(void *data)
+{
+	struct amdgpu_metrics_private *priv = data;
+
+	/* Not fatal, gpu_metrics is still fresh. */
+	amdgpu_metrics_read_companions(priv);
+
+	amdgpu_metrics_derived_update(priv);
+
+	/* Not registered yet while taking the first snapshot. */
+	if (priv->hwmon_dev)
+		amdgpu_metrics_ext_notify(priv);
+
+	trace_amdgpu_metrics_sample(priv->path, &priv->common);
+
+	if (priv->history.depth)
+		amdgpu_metrics_history_record(priv);
+}
+
+static const struct amdgpu_metrics_refresh_ops amdgpu_metrics_refresh_ops = {
+	.skipped = amdgpu_metrics_refresh_skipped,
+	.admit = amdgpu_metrics_refresh_admit,
+	.update = amdgpu_metrics_refresh_update,
+	.updated = amdgpu_metrics_refresh_updated,
+};
+
+/* See amdgpu_metrics_refresh(). */
+static int amdgpu_metrics_update_gpu_metrics(struct amdgpu_metrics_private *priv, bool force)
+{
+	return amdgpu_metrics_refresh(&priv->refresh, &amdgpu_metrics_refresh_ops, priv, force);
+}
+
+/* Must be called with metrics_lock held. */
+static int amdgpu_metrics_read_locked(struct amdgpu_metrics_private *priv,
+				      enum hwmon_sensor_types type, u32 attr, int channel, bool core,
+				      long *val)
+{
+	int err = -EOPNOTSUPP;
+	uint64_t raw;
+	uint32_t multiplier = GET_MULTIPLIER(type);
+
+	if (WARN_ON(multiplier == 0))
+		return err;
+
+	if (type == hwmon_temp && attr == hwmon_temp_input)
+		err = core ? GET_CORE_TEMP(&priv->common, channel, &raw)
+			   : GET_TEMP(&priv->common, channel, &raw);
+	else if (type == hwmon_power && attr == hwmon_power_input)
+		err = core ? GET_CORE_POWER(&priv->common, channel, &raw)
+			   : GET_POWER(&priv->common, channel, &raw);
+	else if (type == hwmon_power && (attr == hwmon_power_cap || attr == hwmon_power_cap_max))
+		err = amdgpu_metrics_get_opt_val(&priv->common,
+						 amdgpu_metrics_power_cap_channel(priv, attr), &raw);
+	else if (type == hwmon_magic_freq && attr == hwmon_magic_freq_input)
+		err = core ? GET_CORE_FREQ(&priv->common, channel, &raw)
+			   : GET_FREQ(&priv->common, channel, &raw);
+	else if (type == hwmon_in && attr == hwmon_in_input)
+		err = GET_IN(&priv->common, channel, &raw);
+	else if (type == hwmon_curr && attr == hwmon_curr_input)
+		err = GET_CURR(&priv->common, channel, &raw);
+	else if (type == hwmon_fan && attr == hwmon_fan_input)
+		err = GET_FAN(&priv->common, channel, &raw);
+
+	if (!err)
+		*val = raw * multiplier;
+
+	return err;
+}
+
+static int amdgpu_metrics_read(struct amdgpu_metrics_private *priv, enum hwmon_sensor_types type,
+			       u32 attr, int channel, bool core, long *val)
+{
+	u64 start;
+	int err;
+
+	this_cpu_inc(priv->stats->reads);
+
+	if (amdgpu_metrics_update_gpu_metrics(priv, false) < 0)
+		return -EIO;
+
+	start = ktime_get_ns();
+	guard(rwsem_read)(&priv->refresh.metrics_lock);
+	this_cpu_add(priv->stats->lock_wait_ns, ktime_get_ns() - start);
+
+	err = amdgpu_metrics_read_locked(priv, type, attr, channel, core, val);
+
+	trace_amdgpu_metrics_read(priv->path, type, channel, core, err, err ? 0 : *val);
+	return err;
+}
+
+static int amdgpu_metrics_hwmon_read(struct device *dev, enum hwmon_sensor_types type,
+				     u32 attr, int channel, long *val)
+{
+	struct amdgpu_metrics_private *priv = dev_get_drvdata(dev);
+
+	return amdgpu_metrics_read(priv, type, attr, channel, false, val);
+}
+
+static int amdgpu_metrics_per_core_read(struct device *dev, enum hwmon_sensor_types type,
+					u32 attr, int channel, long *val)
+{
+	struct amdgpu_metrics_private *priv = dev_get_drvdata(dev);
+
+	if (WARN_ON(channel >= NCORES))
+		return -EOPNOTSUPP;
+
+	channel = priv->per_core_channel_remap[channel].idx;
+
+	return amdgpu_metrics_read(priv, type, attr, channel, true, val);
+}
+
+static const struct hwmon_channel_info *const amdgpu_metrics_hwmon_info[] = {
+	HWMON_CHANNEL_INFO(temp, REPEAT_NCHANNELS_TEMP(HWMON_T_INPUT | HWMON_T_LABEL)),
+	/* Only the socket power has caps. */
+	HWMON_CHANNEL_INFO(power, REPEAT_NCHANNELS_POWER(HWMON_P_INPUT | HWMON_P_LABEL |
+							 HWMON_P_CAP | HWMON_P_CAP_MAX)),
+	HWMON_CHANNEL_INFO(in, REPEAT_NCHANNELS_IN(HWMON_I_INPUT | HWMON_I_LABEL)),
+	HWMON_CHANNEL_INFO(curr, REPEAT_NCHANNELS_CURR(HWMON_C_INPUT | HWMON_C_LABEL)),
+	HWMON_CHANNEL_INFO(fan, REPEAT_NCHANNELS_FAN(HWMON_F_INPUT | HWMON_F_LABEL)),
+	NULL
+};
+
+/*
+ * Snapshots are numbered by generation. Reading several channels from one
+ * generation needs "bulk": write attribute names, e.g., "temp1_input
+ * power1_input freq1_input", to "select", then read them all at once from
+ * "bulk". All visible channels are read if none is selected.
+ */
+static const struct amdgpu_metrics_select_type {
+	const char *prefix;
+	enum hwmon_sensor_types type;
+	u32 attr;
+	unsigned int nchannels;
+} amdgpu_metrics_select_types[] = {
+	{ "temp", hwmon_temp, hwmon_temp_input, NCHANNELS_TEMP },
+	{ "power", hwmon_power, hwmon_power_input, NCHANNELS_POWER },
+	{ "freq", hwmon_magic_freq, hwmon_magic_freq_input, NCHANNELS_FREQ },
+	{ "in", hwmon_in, hwmon_in_input, NCHANNELS_IN },
+	{ "curr", hwmon_curr, hwmon_curr_input, NCHANNELS_CURR },
+	{ "fan", hwmon_fan, hwmon_fan_input, NCHANNELS_FAN },
+};
+
+static const struct amdgpu_metrics_select_type *
+amdgpu_metrics_select_type(enum hwmon_sensor_types type)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(amdgpu_metrics_select_types); i++) {
+		if (amdgpu_metrics_select_types[i].type == type)
+			return &amdgpu_metrics_select_types[i];
+	}
+
+	return NULL;
+}
+
+static int amdgpu_metrics_select_parse(struct amdgpu_metrics_private *priv, const char *name,
+				       struct amdgpu_metrics_selected *selected)
+{
+	unsigned int i, nr;
+	size_t len;
+	int end;
+
+	for (i = 0; i < ARRAY_SIZE(amdgpu_metrics_select_types); i++) {
+		if (!str_has_prefix(name, amdgpu_metrics_select_types[i].prefix))
+			continue;
+
+		len = strlen(amdgpu_metrics_select_types[i].prefix);
+		end = -1;
+		if (sscanf(name + len, "%u_input%n", &nr, &end) != 1 || end < 0 ||
+		    name[len + end] != '\0' || nr == 0 || nr > U8_MAX)
+			return -EINVAL;
+
+		if (!amdgpu_metrics_hwmon_is_visible(priv, amdgpu_metrics_select_types[i].type,
+						     0, nr - 1))
+			return -ENOENT;
+
+		*selected = (struct amdgpu_metrics_selected) {
+			.type = amdgpu_metrics_select_types[i].type,
+			.channel = nr - 1,
+		};
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+static ssize_t generation_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct amdgpu_metrics_private *priv = dev_get_drvdata(dev);
+
+	guard(rwsem_read)(&priv->refresh.metrics_lock);
+
+	return sysfs_emit(buf, "%llu\n", priv->refresh.generation);
+}
+
+static ssize_t select_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct amdgpu_metrics_private *priv = dev_get_drvdata(dev);
+	int len = 0;
+	unsigned int i;
+
+	guard(rwsem_read)(&priv->refresh.metrics_lock);
+
+	for (i = 0; i < priv->select.count; i++)
+		len += sysfs_emit_at(buf, len, "%s%s%d_input", i ? " " : "",
+				     amdgpu_metrics_select_type(priv->select.channels[i].type)->prefix,
+				     priv->select.channels[i].channel + 1);
+
+	return len + sysfs_emit_at(buf, len, "\n");
+}
+
+static ssize_t select_store(struct device *dev, struct device_attribute *attr,
+			    const char *buf, size_t count)
+{
+	struct amdgpu_metrics_private *priv = dev_get_drvdata(dev);
+	struct amdgpu_metrics_selected selected[ARRAY_SIZE(priv->select.channels)];
+	char *names __free(kfree) = kstrndup(buf, count, GFP_KERNEL);
+	char *name, *p = names;
+	unsigned int n = 0;
+	int err;
+
+	if (names == NULL)
+		return -ENOMEM;
+
+	while ((name = strsep(&p, " ,\t\n")) != NULL) {
+		if (*name == '\0')
+			continue;
+		if (n >= ARRAY_SIZE(selected))
+			return -E2BIG;
+		err = amdgpu_metrics_select_parse(priv, name, &selected[n++]);
+		if (err)
+			return err;
+	}
+
+	guard(rwsem_write)(&priv->refresh.metrics_lock);
+
+	memcpy(priv->select.channels, selected, n * sizeof(*selected));
+	priv->select.count = n;
+
+	return count;
+}
+
+static int amdgpu_metrics_bulk_emit(struct amdgpu_metrics_private *priv, char *buf, int len,
+				    const struct amdgpu_metrics_select_type *type, int channel)
+{
+	long val;
+
+	/* Channels without a measurement in this generation are left out. */
+	if (amdgpu_metrics_read_locked(priv, type->type, type->attr, channel, false, &val))
+		return 0;
+
+	return sysfs_emit_at(buf, len, "%s%d_input %ld\n", type->prefix, channel + 1, val);
+}
+
+static ssize_t bulk_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct amdgpu_metrics_private *priv = dev_get_drvdata(dev);
+	const struct amdgpu_metrics_select_type *type;
+	unsigned int i, channel;
+	int len;
+
+	this_cpu_inc(priv->stats->reads);
+
+	if (amdgpu_metrics_update_gpu_metrics(priv, false) < 0)
+		return -EIO;
+
+	guard(rwsem_read)(&priv->refresh.metrics_lock);
+
+	len = sysfs_emit(buf, "generation %llu\n", priv->refresh.generation);
+
+	for (i = 0; i < priv->select.count; i++)
+		len += amdgpu_metrics_bulk_emit(
+			priv, buf, len, amdgpu_metrics_select_type(priv->select.channels[i].type),
+			priv->select.channels[i].channel);
+
+	if (priv->select.count)
+		return len;
+
+	for (i = 0; i < ARRAY_SIZE(amdgpu_metrics_select_types); i++) {
+		type = &amdgpu_metrics_select_types[i];
+		for (channel = 0; channel < type->nchannels; channel++) {
+			if (amdgpu_metrics_hwmon_is_visible(priv, type->type, 0, channel))
+				len += amdgpu_metrics_bulk_emit(priv, buf, len, type, channel);
+		}
+	}
+
+	return len;
+}
+
+static DEVICE_ATTR_RO(generation);
+static DEVICE_ATTR_RW(select);
+static DEVICE_ATTR_RO(bulk);
+
+static struct attribute *amdgpu_metrics_snapshot_attributes[] = {
+	&dev_attr_generation.attr,
+	&dev_attr_select.attr,
+	&dev_attr_bulk.attr,
+	NULL
+};
+
+/*
+ * Like time_in_state of cpufreq: "<MHz> <ms>" per line, where MHz is the lower
+ * boundary of each bucket.
+ */
+static ssize_t amdgpu_metrics_time_in_state_show(struct device *dev,
+						 struct device_attribute *attr, char *buf)
+{
+	struct amdgpu_metrics_private *priv = dev_get_drvdata(dev);
+	unsigned int domain = to_sensor_dev_attr_2(attr)->index;
+	unsigned int bucket;
+	int len = 0;
+
+	guard(rwsem_read)(&priv->refresh.metrics_lock);
+
+	for (bucket = 0; bucket <= time_in_state_nbuckets; bucket++)
+		len += sysfs_emit_at(buf, len, "%u %llu\n",
+				     bucket ? time_in_state_mhz[bucket - 1] : 0,
+				     div_u64(priv->time_in_state.time[domain][bucket],
+					     NSEC_PER_MSEC));
+
+	return len;
+}
+
+#define PREFIXED_SENSOR_DEVICE_ATTR_2_RO(_prefix, _name, _func, _nr, _index)	\
+struct sensor_device_attribute_2 sensor_dev_attr_ ##_prefix ##_ ##_name		\
+	= SENSOR_ATTR_2(_name, 0444, _func, NULL, _nr, _index)
+
+#define TIME_IN_STATE_ATTR(_domain)						\
+static PREFIXED_SENSOR_DEVICE_ATTR_2_RO(tis, _domain,				\
+	amdgpu_metrics_time_in_state_show, 0, tis_ ##_domain)
+
+#define REF_TIME_IN_STATE_ATTR(_domain)						\
+	&sensor_dev_attr_tis_ ##_domain.dev_attr.attr
+
+TIME_IN_STATE_ATTR(gfxclk);
+TIME_IN_STATE_ATTR(socclk);
+TIME_IN_STATE_ATTR(uclk);
+TIME_IN_STATE_ATTR(fclk);
+TIME_IN_STATE_ATTR(coreclk);
+
+static struct attribute *amdgpu_metrics_time_in_state_attributes[] = {
+	REF_TIME_IN_STATE_ATTR(gfxclk),
+	REF_TIME_IN_STATE_ATTR(socclk),
+	REF_TIME_IN_STATE_ATTR(uclk),
+	REF_TIME_IN_STATE_ATTR(fclk),
+	REF_TIME_IN_STATE_ATTR(coreclk),
+	NULL
+};
+
+static umode_t amdgpu_metrics_time_in_state_is_visible(struct kobject *kobj,
+							struct attribute *attr, int index)
+{
+	const struct amdgpu_metrics_private *priv = dev_get_drvdata(kobj_to_dev(kobj));
+	uint64_t freq;
+
+	return sample_interval_ms && amdgpu_metrics_channel_group_enabled(cg_time_in_state) &&
+	       !amdgpu_metrics_time_in_state_freq(priv, index, &freq) ? attr->mode : 0;
+}
+
+static const struct attribute_group amdgpu_metrics_time_in_state_attrgroup = {
+	.name = "time_in_state",
+	.is_visible = amdgpu_metrics_time_in_state_is_visible,
+	.attrs = amdgpu_metrics_time_in_state_attributes,
+};
+
+static const struct attribute_group amdgpu_metrics_snapshot_attrgroup = {
+	.attrs = amdgpu_metrics_snapshot_attributes,
+};
+
+/* Kinds of groups with a single reading per channel */
+static const char * const amdgpu_metrics_input_kinds[] = {
+	"input",
+};
+
+static bool amdgpu_metrics_freq_is_visible(const struct amdgpu_metrics_private *priv,
+					   unsigned int channel, unsigned int kind)
+{
+	return priv->common.remap.freq.data[channel].valid &&
+	       !priv->common.remap.freq.data[channel].ext;
+}
+
+/* In Hz, traced like the HWMON sensor types */
+static int amdgpu_metrics_freq_read(struct amdgpu_metrics_private *priv, unsigned int channel,
+				    unsigned int kind, s64 *val)
+{
+	long raw;
+	int err;
+
+	err = amdgpu_metrics_read_locked(priv, hwmon_magic_freq, hwmon_magic_freq_input,
+					 channel, false, &raw);
+	trace_amdgpu_metrics_read(priv->path, hwmon_magic_freq, channel, false, err,
+				  err ? 0 : raw);
+	if (!err)
+		*val = raw;
+	return err;
+}
+
+/* Core labels are renumbered to skip dummy cores. */
+static const char *amdgpu_metrics_freq_label(const struct amdgpu_metrics_private *priv,
+					     unsigned int channel)
+{
+	return amdgpu_metrics_labels_freq[priv->common.remap.freq.data[channel].idx];
+}
+
+static const struct amdgpu_metrics_ext_group amdgpu_metrics_ext_freq = {
+	.prefix = "freq",
+	.label = amdgpu_metrics_freq_label,
+	.nchannels = NCHANNELS_FREQ,
+	.kinds = amdgpu_metrics_input_kinds,
+	.nkinds = ARRAY_SIZE(amdgpu_metrics_input_kinds),
+	.is_visible = amdgpu_metrics_freq_is_visible,
+	.read = amdgpu_metrics_freq_read,
+};
+
+static bool amdgpu_metrics_per_core_freq_is_visible(const struct amdgpu_metrics_private *priv,
+						    unsigned int channel, unsigned int kind)
+{
+	const remap_t *remap = &priv->per_core_channel_remap[channel];
+
+	return remap->valid && priv->common.remap.freq.coreclk[remap->idx].valid;
+}
+
+static int amdgpu_metrics_per_core_freq_read(struct amdgpu_metrics_private *priv,
+					     unsigned int channel, unsigned int kind, s64 *val)
+{
+	long raw;
+	int err;
+
+	channel = priv->per_core_channel_remap[channel].idx;
+	err = amdgpu_metrics_read_locked(priv, hwmon_magic_freq, hwmon_magic_freq_input,
+					 channel, true, &raw);
+	trace_amdgpu_metrics_read(priv->path, hwmon_magic_freq, channel, true, err,
+				  err ? 0 : raw);
+	if (!err)
+		*val = raw;
+	return err;
+}
+
+/* Unlabeled, like the other channels of the per-CPU-core device */
+static const struct amdgpu_metrics_ext_group amdgpu_metrics_ext_per_core_freq = {
+	.prefix = "freq",
+	.nchannels = NCORES,
+	.kinds = amdgpu_metrics_input_kinds,
+	.nkinds = ARRAY_SIZE(amdgpu_metrics_input_kinds),
+	.is_visible = amdgpu_metrics_per_core_freq_is_visible,
+	.read = amdgpu_metrics_per_core_freq_read,
+};
+
+static bool amdgpu_metrics_activity_is_visible(const struct amdgpu_metrics_private *priv,
+					       unsigned int channel, unsigned int kind)
+{
+	return priv->common.remap.activity.data[channel].valid &&
+	       !priv->common.remap.activity.data[channel].ext;
+}
+
+/* In milli-percent, like throttleN_input */
+static int amdgpu_metrics_activity_read(struct amdgpu_metrics_private *priv, unsigned int channel,
+					unsigned int kind, s64 *val)
+{
+	uint64_t raw;
+	int err;
+
+	err = GET_ACTIVITY(&priv->common, channel, &raw);
+	if (!err)
+		*val = raw * priv->common.channels->activity_unit;
+	return err;
+}
+
+static const struct amdgpu_metrics_ext_group amdgpu_metrics_ext_activity = {
+	.prefix = "activity",
+	.labels = amdgpu_metrics_labels_activity,
+	.nchannels = NCHANNELS_ACTIVITY,
+	.kinds = amdgpu_metrics_input_kinds,
+	.nkinds = ARRAY_SIZE(amdgpu_metrics_input_kinds),
+	.is_visible = amdgpu_metrics_activity_is_visible,
+	.read = amdgpu_metrics_activity_read,
+};
+
+static bool amdgpu_metrics_bandwidth_is_visible(const struct amdgpu_metrics_private *priv,
+						unsigned int channel, unsigned int kind)
+{
+	return priv->common.remap.bandwidth.data[channel].valid &&
+	       !priv->common.remap.bandwidth.data[channel].ext;
+}
+
+/* In MB/s, which would overflow a 32-bit long in B/s */
+static int amdgpu_metrics_bandwidth_read(struct amdgpu_metrics_private *priv,
+					 unsigned int channel, unsigned int kind, s64 *val)
+{
+	uint64_t raw;
+	int err;
+
+	err = GET_BANDWIDTH(&priv->common, channel, &raw);
+	if (!err)
+		*val = raw;
+	return err;
+}
+
+static const struct amdgpu_metrics_ext_group amdgpu_metrics_ext_bandwidth = {
+	.prefix = "bandwidth",
+	.labels = amdgpu_metrics_labels_bandwidth,
+	.nchannels = NCHANNELS_BANDWIDTH,
+	.kinds = amdgpu_metrics_input_kinds,
+	.nkinds = ARRAY_SIZE(amdgpu_metrics_input_kinds),
+	.is_visible = amdgpu_metrics_bandwidth_is_visible,
+	.read = amdgpu_metrics_bandwidth_read,
+};
+
+static bool amdgpu_metrics_util_is_visible(const struct amdgpu_metrics_private *priv,
+					   unsigned int channel, unsigned int kind)
+{
+	const remap_t *remap = priv->common.remap.busy_acc.data;
+	unsigned int i;
+
+	if (!is_channel_valid(priv->common.channels->acc_counter))
+		return false;
+
+	if (channel < UTIL_XCP0)
+		return remap[channel].valid;
+
+	for (i = 0; i < NXCC; i++) {
+		if (remap[UTIL_XCP0 + (channel - UTIL_XCP0) * NXCC + i].valid)
+			return true;
+	}
+
+	return false;
+}
+
+/* In milli-percent, over the interval between the last two refreshes */
+static int amdgpu_metrics_util_read(struct amdgpu_metrics_private *priv, unsigned int channel,
+				    unsigned int kind, s64 *val)
+{
+	if (!priv->acc.has_rates)
+		return -ENODATA;
+
+	*val = priv->acc.util[channel];
+	return 0;
+}
+
+static const struct amdgpu_metrics_ext_group amdgpu_metrics_ext_util = {
+	.prefix = "util",
+	.labels = amdgpu_metrics_labels_util,
+	.nchannels = NCHANNELS_UTIL,
+	.kinds = amdgpu_metrics_input_kinds,
+	.nkinds = ARRAY_SIZE(amdgpu_metrics_input_kinds),
+	.is_visible = amdgpu_metrics_util_is_visible,
+	.read = amdgpu_metrics_util_read,
+};
+
+enum amdgpu_metrics_link_kind {
+	link_input, /* B/s, instantaneous */
+	link_read, /* B/s, in the last interval */
+	link_write, /* B/s, in the last interval */
+	link_width, /* Lanes */
+	link_speed, /* MT/s (PCIe) or Mbps (XGMI) per lane */
+	link_status, /* 1 if active */
+};
+
+static const char * const amdgpu_metrics_link_kinds[] = {
+	[link_input] = "input",
+	[link_read] = "read",
+	[link_write] = "write",
+	[link_width] = "width",
+	[link_speed] = "speed",
+	[link_status] = "status",
+};
+
+static channel_t amdgpu_metrics_link_channel(const struct amdgpu_metrics_private *priv,
+					     unsigned int channel, unsigned int kind)
+{
+	const struct amdgpu_metrics_def *channels = priv->common.channels;
+
+	switch (kind) {
+	case link_input:
+		return channels->link.bandwidth.data[channel];
+	case link_read:
+		return channels->link.read_acc.data[channel];
+	case link_write:
+		return channels->link.write_acc.data[channel];
+	case link_width:
+		return channels->link.width.data[channel];
+	case link_speed:
+		return channels->link.speed.data[channel];
+	case link_status:
+		return channels->link.status.data[channel];
+	}
+
+	return (channel_t) { .type = channel_null };
+}
+
+static bool amdgpu_metrics_link_is_visible(const struct amdgpu_metrics_private *priv,
+					   unsigned int channel, unsigned int kind)
+{
+	const struct amdgpu_metrics_def *channels = priv->common.channels;
+	uint64_t val;
+
+	/* Only present XGMI links are filled in, but their width and speed are shared. */
+	if (channel != LINK_PCIE &&
+	    amdgpu_metrics_get_opt_val(&priv->common, channels->link.read_acc.data[channel], &val))
+		return false;
+
+	if ((kind == link_read || kind == link_write) &&
+	    amdgpu_metrics_get_opt_val(&priv->common, channels->fw_timestamp, &val))
+		return false;
+
+	return !amdgpu_metrics_get_opt_val(&priv->common,
+					   amdgpu_metrics_link_channel(priv, channel, kind), &val);
+}
+
+static int amdgpu_metrics_link_read(struct amdgpu_metrics_private *priv, unsigned int channel,
+				    unsigned int kind, s64 *val)
+{
+	uint64_t raw;
+	int err;
+
+	if (kind == link_read || kind == link_write) {
+		if (!priv->link.has_rates)
+			return -ENODATA;
+		*val = kind == link_read ? priv->link.read[channel] : priv->link.write[channel];
+		return 0;
+	}
+
+	err = amdgpu_metrics_get_opt_val(&priv->common,
+					 amdgpu_metrics_link_channel(priv, channel, kind), &raw);
+	if (err)
+		return err;
+
+	switch (kind) {
+	case link_input:
+		*val = raw * 1000000000; /* GB/s */
+		break;
+	case link_speed:
+		*val = raw * (channel == LINK_PCIE ? 100 : 1000);
+		break;
+	default:
+		*val = raw;
+		break;
+	}
+
+	return 0;
+}
+
+static const struct amdgpu_metrics_ext_group amdgpu_metrics_ext_link = {
+	.prefix = "link",
+	.labels = amdgpu_metrics_labels_link,
+	.nchannels = NCHANNELS_LINK,
+	.kinds = amdgpu_metrics_link_kinds,
+	.nkinds = ARRAY_SIZE(amdgpu_metrics_link_kinds),
+	.is_visible = amdgpu_metrics_link_is_visible,
+	.read = amdgpu_metrics_link_read,
+};
+
+enum amdgpu_metrics_pcie_error_kind {
+	pcie_error_acc, /* Raw counter */
+	pcie_error_rate, /* milli-Hz, in the last interval */
+	pcie_error_alarm, /* 1 if the rate reaches pcie_error_rate_alarm */
+};
+
+static const char * const amdgpu_metrics_pcie_error_kinds[] = {
+	[pcie_error_acc] = "acc",
+	[pcie_error_rate] = "rate",
+	[pcie_error_alarm] = "alarm",
+};
+
+static bool amdgpu_metrics_pcie_error_is_visible(const struct amdgpu_metrics_private *priv,
+						 unsigned int channel, unsigned int kind)
+{
+	if (!priv->common.remap.pcie_error.data[channel].valid)
+		return false;
+
+	return kind == pcie_error_acc || is_channel_valid(priv->common.channels->fw_timestamp);
+}
+
+static int amdgpu_metrics_pcie_error_read(struct amdgpu_metrics_private *priv,
+					  unsigned int channel, unsigned int kind, s64 *val)
+{
+	uint64_t raw;
+	int err;
+
+	switch (kind) {
+	case pcie_error_acc:
+		err = GET_PCIE_ERROR(&priv->common, channel, &raw);
+		if (!err)
+			*val = raw;
+		return err;
+	case pcie_error_rate:
+		if (!priv->link.has_rates)
+			return -ENODATA;
+		*val = priv->link.error_rate[channel];
+		return 0;
+	case pcie_error_alarm:
+		*val = !!(priv->link.error_alarm & BIT(channel));
+		return 0;
+	}
+
+	return -EOPNOTSUPP;
+}
+
+static bool amdgpu_metrics_pcie_error_changed(const struct amdgpu_metrics_private *priv,
+					      unsigned int channel, unsigned int kind)
+{
+	return kind == pcie_error_alarm && (priv->link.error_alarm_changed & BIT(channel));
+}
+
+static const struct amdgpu_metrics_ext_group amdgpu_metrics_ext_pcie_error = {
+	.prefix = "pcie_error",
+	.labels = amdgpu_metrics_labels_pcie_error,
+	.nchannels = NCHANNELS_PCIE_ERROR,
+	.kinds = amdgpu_metrics_pcie_error_kinds,
+	.nkinds = ARRAY_SIZE(amdgpu_metrics_pcie_error_kinds),
+	.is_visible = amdgpu_metrics_pcie_error_is_visible,
+	.read = amdgpu_metrics_pcie_error_read,
+	.changed = amdgpu_metrics_pcie_error_changed,
+};
+
+enum amdgpu_metrics_throttle_kind {
+	throttle_input, /* milli-percent of the last interval */
+	throttle_acc, /* raw accumulator */
+};
+
+static const char * const amdgpu_metrics_throttle_kinds[] = {
+	[throttle_input] = "input",
+	[throttle_acc] = "acc",
+};
+
+static bool amdgpu_metrics_throttle_is_visible(const struct amdgpu_metrics_private *priv,
+					       unsigned int channel, unsigned int kind)
+{
+	if (!priv->common.remap.throttle.data[channel].valid)
+		return false;
+
+	return kind != throttle_input || is_channel_valid(priv->common.channels->acc_counter);
+}
+
+static int amdgpu_metrics_throttle_read(struct amdgpu_metrics_private *priv, unsigned int channel,
+					unsigned int kind, s64 *val)
+{
+	uint64_t raw;
+	int err;
+
+	switch (kind) {
+	case throttle_input:
+		if (!priv->acc.has_rates)
+			return -ENODATA;
+		*val = priv->acc.throttle[channel];
+		return 0;
+	case throttle_acc:
+		err = GET_THROTTLE(&priv->common, channel, &raw);
+		if (!err)
+			*val = raw;
+		return err;
+	}
+
+	return -EOPNOTSUPP;
+}
+
+static const struct amdgpu_metrics_ext_group amdgpu_metrics_ext_throttle = {
+	.prefix = "throttle",
+	.labels = amdgpu_metrics_labels_throttle,
+	.nchannels = NCHANNELS_THROTTLE,
+	.kinds = amdgpu_metrics_throttle_kinds,
+	.nkinds = ARRAY_SIZE(amdgpu_metrics_throttle_kinds),
+	.is_visible = amdgpu_metrics_throttle_is_visible,
+	.read = amdgpu_metrics_throttle_read,
+};
+
+enum amdgpu_metrics_throttler_kind {
+	throttler_alarm, /* 1 if the throttler is active */
+};
+
+static const char * const amdgpu_metrics_throttler_kinds[] = {
+	[throttler_alarm] = "alarm",
+};
+
+static bool amdgpu_metrics_throttler_is_visible(const struct amdgpu_metrics_private *priv,
+						unsigned int channel, unsigned int kind)
+{
+	return priv->throttler.valid;
+}
+
+static int amdgpu_metrics_throttler_read(struct amdgpu_metrics_private *priv,
+					 unsigned int channel, unsigned int kind, s64 *val)
+{
+	*val = !!(priv->throttler.status & BIT_ULL(amdgpu_metrics_throttler_bits[channel]));
+	return 0;
+}
+
+static bool amdgpu_metrics_throttler_changed(const struct amdgpu_metrics_private *priv,
+					     unsigned int channel, unsigned int kind)
+{
+	return priv->throttler.changed & BIT_ULL(amdgpu_metrics_throttler_bits[channel]);
+}
+
+static const struct amdgpu_metrics_ext_group amdgpu_metrics_ext_throttler = {
+	.prefix = "throttler",
+	.labels = amdgpu_metrics_labels_throttler,
+	.nchannels = NCHANNELS_THROTTLER,
+	.kinds = amdgpu_metrics_throttler_kinds,
+	.nkinds = ARRAY_SIZE(amdgpu_metrics_throttler_kinds),
+	.is_visible = amdgpu_metrics_throttler_is_visible,
+	.read = amdgpu_metrics_throttler_read,
+	.changed = amdgpu_metrics_throttler_changed,
+};
+
+static const char *amdgpu_metrics_labels_headroom[] = {
+	"STAPM",
+};
+
+static bool amdgpu_metrics_headroom_is_visible(const struct amdgpu_metrics_private *priv,
+					       unsigned int channel, unsigned int kind)
+{
+	return priv->power.valid;
+}
+
+/* In micro-Watts, like power1_cap minus power1_input */
+static int amdgpu_metrics_headroom_read(struct amdgpu_metrics_private *priv,
+					unsigned int channel, unsigned int kind, s64 *val)
+{
+	if (!priv->power.valid)
+		return -ENODATA;
+
+	*val = priv->power.headroom;
+	return 0;
+}
+
+static const struct amdgpu_metrics_ext_group amdgpu_metrics_ext_headroom = {
+	.prefix = "headroom",
+	.labels = amdgpu_metrics_labels_headroom,
+	.nchannels = ARRAY_SIZE(amdgpu_metrics_labels_headroom),
+	.kinds = amdgpu_metrics_input_kinds,
+	.nkinds = ARRAY_SIZE(amdgpu_metrics_input_kinds),
+	.is_visible = amdgpu_metrics_headroom_is_visible,
+	.read = amdgpu_metrics_headroom_read,
+};
+
+static const struct amdgpu_metrics_ext_group *const amdgpu_metrics_ext_groups[] = {
+	&amdgpu_metrics_ext_freq,
+	&amdgpu_metrics_ext_headroom,
+	&amdgpu_metrics_ext_activity,
+	&amdgpu_metrics_ext_bandwidth,
+	&amdgpu_metrics_ext_util,
+	&amdgpu_metrics_ext_link,
+	&amdgpu_metrics_ext_pcie_error,
+	&amdgpu_metrics_ext_throttle,
+	&amdgpu_metrics_ext_throttler,
+};
+
+enum amdgpu_metrics_xcc_kind {
+	xcc_input, /* Milli-percent, instantaneous */
+	xcc_util, /* Milli-percent, in the last interval */
+	xcc_acc, /* Raw busy accumulator */
+	xcc_below_host_limit_acc,
+	xcc_below_host_limit_ppt_acc,
+	xcc_below_host_limit_thm_acc,
+	xcc_low_utilization_acc,
+};
+
+static const char * const amdgpu_metrics_xcc_kinds[] = {
+	[xcc_input] = "input",
+	[xcc_util] = "util",
+	[xcc_acc] = "acc",
+	[xcc_below_host_limit_acc] = "below_host_limit_acc",
+	[xcc_below_host_limit_ppt_acc] = "below_host_limit_ppt_acc",
+	[xcc_below_host_limit_thm_acc] = "below_host_limit_thm_acc",
+	[xcc_low_utilization_acc] = "low_utilization_acc",
+};
+
+/* Index of the busy accumulator of an XCC in the busy_acc group */
+#define XCC_BUSY_ACC(_xcp, _xcc) (UTIL_XCP0 + (_xcp) * NXCC + (_xcc))
+
+static channel_t amdgpu_metrics_xcc_channel(const struct amdgpu_metrics_private *priv,
+					    unsigned int xcc, unsigned int kind)
+{
+	const struct amdgpu_metrics_xcp_def *xcp = &priv->common.channels->xcp;
+
+	switch (kind) {
+	case xcc_input:
+		return xcp->gfx_busy[xcc];
+	case xcc_below_host_limit_acc:
+		return xcp->below_host_limit[xcc];
+	case xcc_below_host_limit_ppt_acc:
+		return xcp->below_host_limit_ppt[xcc];
+	case xcc_below_host_limit_thm_acc:
+		return xcp->below_host_limit_thm[xcc];
+	case xcc_low_utilization_acc:
+		return xcp->low_utilization[xcc];
+	}
+
+	return (channel_t) { .type = channel_null };
+}
+
+static bool amdgpu_metrics_xcc_is_visible(const struct amdgpu_metrics_private *priv,
+					  unsigned int channel, unsigned int kind)
+{
+	unsigned int xcp = channel / NXCC, xcc = channel % NXCC;
+	uint64_t val;
+
+	if (kind == xcc_util || kind == xcc_acc)
+		return is_channel_valid(priv->common.channels->acc_counter) &&
+		       priv->common.remap.busy_acc.data[XCC_BUSY_ACC(xcp, xcc)].valid;
+
+	/* Absent XCCs are filled with all ones. */
+	return !amdgpu_metrics_get_xcp_val(&priv->common,
+					   amdgpu_metrics_xcc_channel(priv, xcc, kind), xcp, &val);
+}
+
+static int amdgpu_metrics_xcc_read(struct amdgpu_metrics_private *priv, unsigned int channel,
+				   unsigned int kind, s64 *val)
+{
+	unsigned int xcp = channel / NXCC, xcc = channel % NXCC;
+	uint64_t raw;
+	int err;
+
+	switch (kind) {
+	case xcc_util:
+		if (!priv->acc.has_rates)
+			return -ENODATA;
+		*val = priv->acc.xcc_util[xcp][xcc];
+		return 0;
+	case xcc_acc:
+		err = GET_BUSY_ACC(&priv->common, XCC_BUSY_ACC(xcp, xcc), &raw);
+		break;
+	default:
+		err = amdgpu_metrics_get_xcp_val(&priv->common,
+						 amdgpu_metrics_xcc_channel(priv, xcc, kind),
+						 xcp, &raw);
+		break;
+	}
+	if (err)
+		return err;
+
+	*val = kind == xcc_input ? raw * ACTIVITY_UNIT_PERCENT : raw;
+	return 0;
+}
+
+static const struct amdgpu_metrics_ext_group amdgpu_metrics_ext_xcc = {
+	.prefix = "xcc",
+	.labels = amdgpu_metrics_labels_xcc,
+	.nchannels = NXCC,
+	.kinds = amdgpu_metrics_xcc_kinds,
+	.nkinds = ARRAY_SIZE(amdgpu_metrics_xcc_kinds),
+	.is_visible = amdgpu_metrics_xcc_is_visible,
+	.read = amdgpu_metrics_xcc_read,
+};
+
+static bool amdgpu_metrics_vcn_is_visible(const struct amdgpu_metrics_private *priv,
+					  unsigned int channel, unsigned int kind)
+{
+	uint64_t val;
+
+	return !amdgpu_metrics_get_xcp_val(&priv->common,
+					   priv->common.channels->xcp.vcn_busy[channel % NVCN],
+					   channel / NVCN, &val);
+}
+
+/* In milli-percent, like activityN_input */
+static int amdgpu_metrics_vcn_read(struct amdgpu_metrics_private *priv, unsigned int channel,
+				   unsigned int kind, s64 *val)
+{
+	uint64_t raw;
+	int err;
+
+	err = amdgpu_metrics_get_xcp_val(&priv->common,
+					 priv->common.channels->xcp.vcn_busy[channel % NVCN],
+					 channel / NVCN, &raw);
+	if (!err)
+		*val = raw * ACTIVITY_UNIT_PERCENT;
+	return err;
+}
+
+static const struct amdgpu_metrics_ext_group amdgpu_metrics_ext_vcn = {
+	.prefix = "vcn",
+	.labels = amdgpu_metrics_labels_vcn,
+	.nchannels = NVCN,
+	.kinds = amdgpu_metrics_input_kinds,
+	.nkinds = ARRAY_SIZE(amdgpu_metrics_input_kinds),
+	.is_visible = amdgpu_metrics_vcn_is_visible,
+	.read = amdgpu_metrics_vcn_read,
+};
+
+static bool amdgpu_metrics_jpeg_is_visible(const struct amdgpu_metrics_private *priv,
+					   unsigned int channel, unsigned int kind)
+{
+	uint64_t val;
+
+	return !amdgpu_metrics_get_xcp_val(&priv->common,
+					   priv->common.channels->xcp.jpeg_busy[channel % NJPEG],
+					   channel / NJPEG, &val);
+}
+
+/* In milli-percent, like activityN_input */
+static int amdgpu_metrics_jpeg_read(struct amdgpu_metrics_private *priv, unsigned int channel,
+				    unsigned int kind, s64 *val)
+{
+	uint64_t raw;
+	int err;
+
+	err = amdgpu_metrics_get_xcp_val(&priv->common,
+					 priv->common.channels->xcp.jpeg_busy[channel % NJPEG],
+					 channel / NJPEG, &raw);
+	if (!err)
+		*val = raw * ACTIVITY_UNIT_PERCENT;
+	return err;
+}
+
+static const struct amdgpu_metrics_ext_group amdgpu_metrics_ext_jpeg = {
+	.prefix = "jpeg",
+	.labels = amdgpu_metrics_labels_jpeg,
+	.nchannels = NJPEG,
+	.kinds = amdgpu_metrics_input_kinds,
+	.nkinds = ARRAY_SIZE(amdgpu_metrics_input_kinds),
+	.is_visible = amdgpu_metrics_jpeg_is_visible,
+	.read = amdgpu_metrics_jpeg_read,
+};
+
+/* Channels of the NPU device, as the first of each run in its channel group */
+#define NPU_POWER	REMAP_IDX(power, ipu)
+#define NPU_FREQ0	REMAP_IDX(freq, ipuclk)	/* IPUCLK, MPIPUCLK */
+#define NPU_ACTIVITY0	REMAP_IDX(activity, ipu[0])	/* Columns */
+#define NPU_BANDWIDTH0	REMAP_IDX(bandwidth, ipu_reads)	/* Reads, writes */
+#define NPU_NFREQ	2
+#define NPU_NBANDWIDTH	2
+
+static bool amdgpu_metrics_npu_power_is_visible(const struct amdgpu_metrics_private *priv,
+						unsigned int channel, unsigned int kind)
+{
+	return priv->common.remap.power.data[NPU_POWER + channel].valid;
+}
+
+/* In micro-Watts, like powerN_input of the main device */
+static int amdgpu_metrics_npu_power_read(struct amdgpu_metrics_private *priv,
+					 unsigned int channel, unsigned int kind, s64 *val)
+{
+	long raw;
+	int err;
+
+	err = amdgpu_metrics_read_locked(priv, hwmon_power, hwmon_power_input,
+					 NPU_POWER + channel, false, &raw);
+	if (!err)
+		*val = raw;
+	return err;
+}
+
+static const struct amdgpu_metrics_ext_group amdgpu_metrics_ext_npu_power = {
+	.prefix = "power",
+	.labels = amdgpu_metrics_labels_power + NPU_POWER,
+	.nchannels = 1,
+	.kinds = amdgpu_metrics_input_kinds,
+	.nkinds = ARRAY_SIZE(amdgpu_metrics_input_kinds),
+	.is_visible = amdgpu_metrics_npu_power_is_visible,
+	.read = amdgpu_metrics_npu_power_read,
+};
+
+static bool amdgpu_metrics_npu_freq_is_visible(const struct amdgpu_metrics_private *priv,
+					       unsigned int channel, unsigned int kind)
+{
+	return priv->common.remap.freq.data[NPU_FREQ0 + channel].valid;
+}
+
+/* In Hz, like freqN_input of the main device */
+static int amdgpu_metrics_npu_freq_read(struct amdgpu_metrics_private *priv,
+					unsigned int channel, unsigned int kind, s64 *val)
+{
+	long raw;
+	int err;
+
+	err = amdgpu_metrics_read_locked(priv, hwmon_magic_freq, hwmon_magic_freq_input,
+					 NPU_FREQ0 + channel, false, &raw);
+	if (!err)
+		*val = raw;
+	return err;
+}
+
+static const struct amdgpu_metrics_ext_group amdgpu_metrics_ext_npu_freq = {
+	.prefix = "freq",
+	.labels = amdgpu_metrics_labels_freq + NPU_FREQ0,
+	.nchannels = NPU_NFREQ,
+	.kinds = amdgpu_metrics_input_kinds,
+	.nkinds = ARRAY_SIZE(amdgpu_metrics_input_kinds),
+	.is_visible = amdgpu_metrics_npu_freq_is_visible,
+	.read = amdgpu_metrics_npu_freq_read,
+};
+
+static bool amdgpu_metrics_npu_activity_is_visible(const struct amdgpu_metrics_private *priv,
+						   unsigned int channel, unsigned int kind)
+{
+	return priv->common.remap.activity.data[NPU_ACTIVITY0 + channel].valid;
+}
+
+static int amdgpu_metrics_npu_activity_read(struct amdgpu_metrics_private *priv,
+					    unsigned int channel, unsigned int kind, s64 *val)
+{
+	return amdgpu_metrics_activity_read(priv, NPU_ACTIVITY0 + channel, kind, val);
+}
+
+static const struct amdgpu_metrics_ext_group amdgpu_metrics_ext_npu_activity = {
+	.prefix = "activity",
+	.labels = amdgpu_metrics_labels_activity + NPU_ACTIVITY0,
+	.nchannels = NIPU,
+	.kinds = amdgpu_metrics_input_kinds,
+	.nkinds = ARRAY_SIZE(amdgpu_metrics_input_kinds),
+	.is_visible = amdgpu_metrics_npu_activity_is_visible,
+	.read = amdgpu_metrics_npu_activity_read,
+};
+
+static bool amdgpu_metrics_npu_bandwidth_is_visible(const struct amdgpu_metrics_private *priv,
+						    unsigned int channel, unsigned int kind)
+{
+	return priv->common.remap.bandwidth.data[NPU_BANDWIDTH0 + channel].valid;
+}
+
+static int amdgpu_metrics_npu_bandwidth_read(struct amdgpu_metrics_private *priv,
+					     unsigned int channel, unsigned int kind, s64 *val)
+{
+	return amdgpu_metrics_bandwidth_read(priv, NPU_BANDWIDTH0 + channel, kind, val);
+}
+
+static const struct amdgpu_metrics_ext_group amdgpu_metrics_ext_npu_bandwidth = {
+	.prefix = "bandwidth",
+	.labels = amdgpu_metrics_labels_bandwidth + NPU_BANDWIDTH0,
+	.nchannels = NPU_NBANDWIDTH,
+	.kinds = amdgpu_metrics_input_kinds,
+	.nkinds = ARRAY_SIZE(amdgpu_metrics_input_kinds),
+	.is_visible = amdgpu_metrics_npu_bandwidth_is_visible,
+	.read = amdgpu_metrics_npu_bandwidth_read,
+};
+
+/* Channels moved from the main device into the NPU device */
+static const struct amdgpu_metrics_ext_group *const amdgpu_metrics_npu_ext_groups[] = {
+	&amdgpu_metrics_ext_npu_power,
+	&amdgpu_metrics_ext_npu_freq,
+	&amdgpu_metrics_ext_npu_activity,
+	&amdgpu_metrics_ext_npu_bandwidth,
+};
+
+static const struct amdgpu_metrics_ext_group *const amdgpu_metrics_per_core_ext_groups[] = {
+	&amdgpu_metrics_ext_per_core_freq,
+};
+
+/* Instantiated for each partition */
+static const struct amdgpu_metrics_ext_group *const amdgpu_metrics_xcp_ext_groups[] = {
+	&amdgpu_metrics_ext_xcc,
+	&amdgpu_metrics_ext_vcn,
+	&amdgpu_metrics_ext_jpeg,
+};
+
+static ssize_t amdgpu_metrics_ext_show(struct device *dev, struct device_attribute *attr,
+				       char *buf)
+{
+	struct amdgpu_metrics_private *priv = dev_get_drvdata(dev);
+	struct amdgpu_metrics_ext_attr *ext_attr =
+		container_of(attr, struct amdgpu_metrics_ext_attr, dev_attr);
+	s64 val;
+	int err;
+
+	if (ext_attr->kind == EXT_KIND_LABEL)
+		return sysfs_emit(buf, "%s\n",
+				  ext_attr->group->label
+				  ? ext_attr->group->label(priv, ext_attr->channel)
+				  : ext_attr->group->labels[ext_attr->channel %
+							    ext_attr->group->nchannels]);
+
+	this_cpu_inc(priv->stats->reads);
+
+	if (amdgpu_metrics_update_gpu_metrics(priv, false) < 0)
+		return -EIO;
+
+	guard(rwsem_read)(&priv->refresh.metrics_lock);
+
+	err = ext_attr->group->read(priv, ext_attr->channel, ext_attr->kind, &val);
+
+	return err ?: sysfs_emit(buf, "%lld\n", val);
+}
+
+static bool __init amdgpu_metrics_ext_group_enabled(const struct amdgpu_metrics_ext_group *group)
+{
+	int i = match_string(amdgpu_metrics_channel_group_names, NCHANNEL_GROUPS, group->prefix);
+
+	return !WARN_ON(i < 0) && amdgpu_metrics_channel_group_enabled(i);
+}
+
+/* Fill @attrs if not NULL. Returns the number of attributes. */
+static unsigned int __init
+amdgpu_metrics_ext_fill(struct amdgpu_metrics_private *priv,
+			const struct amdgpu_metrics_ext_group *const *groups, unsigned int ngroups,
+			unsigned int instance, struct amdgpu_metrics_ext_attr *attrs)
+{
+	const struct amdgpu_metrics_ext_group *group;
+	struct amdgpu_metrics_ext_attr *attr;
+	unsigned int i, channel, kind, n = 0;
+	bool visible;
+
+	for (i = 0; i < ngroups; i++) {
+		group = groups[i];
+		if (!amdgpu_metrics_ext_group_enabled(group))
+			continue;
+
+		for (channel = 0; channel < group->nchannels; channel++) {
+			visible = false;
+			for (kind = 0; kind <= group->nkinds; kind++) {
+				/* The label goes last, if any other kind is visible. */
+				if (kind == group->nkinds
+				    ? !visible || (group->labels == NULL && group->label == NULL)
+				    : !group->is_visible(priv, instance * group->nchannels + channel,
+							 kind))
+					continue;
+				visible = true;
+
+				if (attrs == NULL) {
+					n++;
+					continue;
+				}
+
+				attr = &attrs[n++];
+				*attr = (struct amdgpu_metrics_ext_attr) {
+					.group = group,
+					.channel = instance * group->nchannels + channel,
+					.kind = kind == group->nkinds ? EXT_KIND_LABEL : kind,
+				};
+				snprintf(attr->name, sizeof(attr->name), "%s%u_%s", group->prefix,
+					 channel + 1,
+					 kind == group->nkinds ? "label" : group->kinds[kind]);
+				sysfs_attr_init(&attr->dev_attr.attr);
+				attr->dev_attr.attr.name = attr->name;
+				attr->dev_attr.attr.mode = 0444;
+				attr->dev_attr.show = amdgpu_metrics_ext_show;
+			}
+		}
+	}
+
+	return n;
+}
+
+static const struct hwmon_ops amdgpu_metrics_hwmon_ops = {
+	.is_visible = amdgpu_metrics_hwmon_is_visible,
+	.read = amdgpu_metrics_hwmon_read,
+	.read_string = amdgpu_metrics_hwmon_read_string,
+};
+
+static const struct hwmon_chip_info amdgpu_metrics_hwmon_chip_info = {
+	.ops = &amdgpu_metrics_hwmon_ops,
+	.info = amdgpu_metrics_hwmon_info,
+};
+
+/*
+ * Labels are intentional not exported, in order that HTOP can correctly
+ * display core temperature on multi cluster (e.g., big.LITTLE) CPUs.
+ */
+static const struct hwmon_channel_info *const amdgpu_metrics_per_core_info[] = {
+	HWMON_CHANNEL_INFO(temp, REPEAT_NCORES(HWMON_T_INPUT)),
+	HWMON_CHANNEL_INFO(power, REPEAT_NCORES(HWMON_P_INPUT)),
+	NULL
+};
+
+static const struct hwmon_ops amdgpu_metrics_per_core_ops = {
+	.is_visible = amdgpu_metrics_per_core_is_visible,
+	.read = amdgpu_metrics_per_core_read,
+};
+
+static const struct hwmon_chip_info amdgpu_metrics_per_core_chip_info = {
+	.ops = &amdgpu_metrics_per_core_ops,
+	.info = amdgpu_metrics_per_core_info,
+};
+
+/*
+ * An HWMON device must be registered with a parent.
+ * We have no choice but to create a dummy one.
+ */
+static struct class *amdgpu_metrics_class;
+static struct device *amdgpu_metrics_device;
+
+/*
+ * Create the attributes of @groups visible for @instance in @attrgroup, which
+ * is left empty if none is. Returns the number of attributes or an error code.
+ */
+static int __init amdgpu_metrics_ext_init_group(struct amdgpu_metrics_private *priv,
+						const struct amdgpu_metrics_ext_group *const *groups,
+						unsigned int ngroups, unsigned int instance,
+						struct attribute_group *attrgroup,
+						struct amdgpu_metrics_ext_attr **ext_attrs)
+{
+	struct amdgpu_metrics_ext_attr *attrs;
+	struct attribute **attributes;
+	unsigned int i, n;
+
+	n = amdgpu_metrics_ext_fill(priv, groups, ngroups, instance, NULL);
+	if (!n)
+		return 0;
+
+	attrs = devm_kcalloc(amdgpu_metrics_device, n, sizeof(*attrs), GFP_KERNEL);
+	attributes = devm_kcalloc(amdgpu_metrics_device, n + 1, sizeof(*attributes), GFP_KERNEL);
+	if (attrs == NULL || attributes == NULL)
+		return -ENOMEM;
+
+	amdgpu_metrics_ext_fill(priv, groups, ngroups, instance, attrs);
+	for (i = 0; i < n; i++)
+		attributes[i] = &attrs[i].dev_attr.attr;
+
+	priv->ext_attr_bytes += n * sizeof(*attrs) + (n + 1) * sizeof(*attributes);
+
+	attrgroup->attrs = attributes;
+	if (ext_attrs)
+		*ext_attrs = attrs;
+	return n;
+}
+
+static int __init amdgpu_metrics_ext_init(struct amdgpu_metrics_private *priv)
+{
+	int n;
+
+	n = amdgpu_metrics_ext_init_group(priv, amdgpu_metrics_ext_groups,
+					  ARRAY_SIZE(amdgpu_metrics_ext_groups), 0,
+					  &priv->ext_attrgroup, &priv->ext_attrs);
+	if (n < 0)
+		return n;
+
+	priv->n_ext_attrs = n;
+	return 0;
+}
+
+/*
+ * Separate NPU channels, if there are any, into the attributes of a dedicated
+ * HWMON device. Must be called before amdgpu_metrics_ext_init(), so that they
+ * are skipped on the main device.
+ */
+static int __init amdgpu_metrics_npu_init(struct amdgpu_metrics_private *priv)
+{
+	struct amdgpu_metrics_labels_remap *remap = &priv->common.remap;
+	unsigned int i;
+	int n;
+
+	n = amdgpu_metrics_ext_init_group(priv, amdgpu_metrics_npu_ext_groups,
+					  ARRAY_SIZE(amdgpu_metrics_npu_ext_groups), 0,
+					  &priv->npu_attrgroup, NULL);
+	if (n <= 0)
+		return n;
+
+	priv->npu_attrgroups[0] = &priv->npu_attrgroup;
+	priv->npu_attrgroups[1] = NULL;
+
+	remap->power.data[NPU_POWER].ext = true;
+	for (i = 0; i < NPU_NFREQ; i++)
+		remap->freq.data[NPU_FREQ0 + i].ext = true;
+	for (i = 0; i < NIPU; i++)
+		remap->activity.data[NPU_ACTIVITY0 + i].ext = true;
+	for (i = 0; i < NPU_NBANDWIDTH; i++)
+		remap->bandwidth.data[NPU_BANDWIDTH0 + i].ext = true;
+
+	return 0;
+}
+
+static int __init amdgpu_metrics_per_core_init(struct amdgpu_metrics_private *priv)
+{
+	int n;
+
+	n = amdgpu_metrics_ext_init_group(priv, amdgpu_metrics_per_core_ext_groups,
+					  ARRAY_SIZE(amdgpu_metrics_per_core_ext_groups), 0,
+					  &priv->per_core_attrgroup, NULL);
+	if (n <= 0)
+		return n;
+
+	priv->per_core_attrgroups[0] = &priv->per_core_attrgroup;
+	priv->per_core_attrgroups[1] = NULL;
+	return 0;
+}
+
+/*
+ * Register a child HWMON device (amdgpu_xcpN) for each active partition with
+ * any of its channels. Their attributes aren't poll(2)-able, so no need to
+ * keep track of them for amdgpu_metrics_ext_notify().
+ */
+static int __init amdgpu_metrics_register_xcps(struct amdgpu_metrics_private *priv)
+{
+	struct amdgpu_metrics_xcp *xcp;
+	struct device *dev;
+	uint64_t num_partition;
+	const char *name;
+	unsigned int i;
+	int n;
+
+	if (amdgpu_metrics_get_opt_val(&priv->common, priv->common.channels->num_partition,
+				       &num_partition))
+		return 0;
+
+	for (i = 0; i < min_t(u64, num_partition, NXCP); i++) {
+		xcp = &priv->xcp[i];
+		n = amdgpu_metrics_ext_init_group(priv, amdgpu_metrics_xcp_ext_groups,
+						  ARRAY_SIZE(amdgpu_metrics_xcp_ext_groups), i,
+						  &xcp->ext_attrgroup, NULL);
+		if (n < 0)
+			return n;
+		if (!n)
+			continue;
+
+		xcp->attrgroups[0] = &xcp->ext_attrgroup;
+		xcp->attrgroups[1] = NULL;
+
+		name = devm_kasprintf(amdgpu_metrics_device, GFP_KERNEL, "amdgpu_xcp%u", i);
+		if (name == NULL)
+			return -ENOMEM;
+
+		dev = devm_hwmon_device_register_with_groups(amdgpu_metrics_device, name, priv,
+							     xcp->attrgroups);
+		if (IS_ERR(dev))
+			return PTR_ERR(dev);
+
+		xcp->hwmon_dev = dev;
+	}
+
+	return 0;
+}
+
+static void __init amdgpu_metrics_init_attrgroups(struct amdgpu_metrics_private *priv)
+{
+	unsigned int i = 0;
+
+	priv->attrgroups[i++] = &amdgpu_metrics_snapshot_attrgroup;
+	priv->attrgroups[i++] = &amdgpu_metrics_time_in_state_attrgroup;
+	/* sysfs refuses empty groups. */
+	if (priv->ext_attrgroup.attrs)
+		priv->attrgroups[i++] = &priv->ext_attrgroup;
+	priv->attrgroups[i] = NULL;
+}
+
+struct amdgpu_metrics_thermal_zone {
+	struct amdgpu_metrics_private *priv;
+	unsigned int channel;
+};
+
+static int amdgpu_metrics_thermal_get_temp(struct thermal_zone_device *tzd, int *temp)
+{
+	struct amdgpu_metrics_thermal_zone *zone = thermal_zone_device_priv(tzd);
+	long val;
+	int err;
+
+	err = amdgpu_metrics_read(zone->priv, hwmon_temp, hwmon_temp_input,
+				  zone->channel, false, &val);
+	if (err)
+		return err;
+
+	*temp = val;
+	return 0;
+}
+
+static const struct thermal_zone_device_ops amdgpu_metrics_thermal_ops = {
+	.get_temp = amdgpu_metrics_thermal_get_temp,
+};
+
+/* Trip points stay disabled until userspace writes their trip_point_*_temp. */
+static const struct thermal_trip amdgpu_metrics_thermal_trips[] = {
+	{
+		.type = THERMAL_TRIP_PASSIVE,
+		.temperature = THERMAL_TEMP_INVALID,
+		.flags = THERMAL_TRIP_FLAG_RW,
+	},
+	{
+		.type = THERMAL_TRIP_HOT,
+		.temperature = THERMAL_TEMP_INVALID,
+		.flags = THERMAL_TRIP_FLAG_RW,
+	},
+	{
+		.type = THERMAL_TRIP_CRITICAL,
+		.temperature = THERMAL_TEMP_INVALID,
+		.flags = THERMAL_TRIP_FLAG_RW,
+	},
+};
+
+/* The temperatures are already exported by our own HWMON devices. */
+static const struct thermal_zone_params amdgpu_metrics_thermal_params = {
+	.no_hwmon = true,
+};
+
+static void amdgpu_metrics_thermal_unregister(void *tzd)
+{
+	thermal_zone_device_unregister(tzd);
+}
+
+static int __init amdgpu_metrics_register_thermal_zone(struct amdgpu_metrics_private *priv,
+						       const char *type, unsigned int channel)
+{
+	struct amdgpu_metrics_thermal_zone *zone;
+	struct thermal_zone_device *tzd;
+	int err;
+
+	if (!priv->common.remap.temp.data[channel].valid)
+		return 0;
+
+	zone = devm_kzalloc(amdgpu_metrics_device, sizeof(*zone), GFP_KERNEL);
+	if (zone == NULL)
+		return -ENOMEM;
+
+	zone->priv = priv;
+	zone->channel = channel;
+
+	tzd = thermal_zone_device_register_with_trips(type, amdgpu_metrics_thermal_trips,
+						      ARRAY_SIZE(amdgpu_metrics_thermal_trips),
+						      zone, &amdgpu_metrics_thermal_ops,
+						      &amdgpu_metrics_thermal_params,
+						      thermal_polling_ms, thermal_polling_ms);
+	err = PTR_ERR_OR_ZERO(tzd);
+	if (err) {
+		pr_err("Failed to register thermal zone %s: %d\n", type, err);
+		return err;
+	}
+
+	err = devm_add_action_or_reset(amdgpu_metrics_device, amdgpu_metrics_thermal_unregister, tzd);
+	if (err)
+		return err;
+
+	return thermal_zone_device_enable(tzd);
+}
+
+static int __init amdgpu_metrics_register_thermal_zones(struct amdgpu_metrics_private *priv)
+{
+	/* THERMAL_NAME_LENGTH is 20, including the null terminator. */
+	char type[THERMAL_NAME_LENGTH];
+	unsigned int i, core;
+	int err;
+
+	err = amdgpu_metrics_register_thermal_zone(priv, "amdgpu_edge",
+						   REMAP_IDX(temp, edge)) ?:
+	      amdgpu_metrics_register_thermal_zone(priv, "amdgpu_hotspot",
+						   REMAP_IDX(temp, hotspot)) ?:
+	      amdgpu_metrics_register_thermal_zone(priv, "amdgpu_soc",
+						   REMAP_IDX(temp, soc));
+	if (err)
+		return err;
+
+	for (i = 0; i < NCORES; i++) {
+		/* Name the zone after the label, i.e., skip dummy cores. */
+		core = priv->common.remap.temp.core[i].idx - REMAP_IDX(temp, core[0]);
+		snprintf(type, sizeof(type), "amdgpu_core%u", core);
+
+		err = amdgpu_metrics_register_thermal_zone(priv, type, REMAP_IDX(temp, core[i]));
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+#if IS_REACHABLE(CONFIG_IIO_TRIGGERED_BUFFER)
+
+/*
+ * IIO has no channel type for frequencies, so clocks are exported as
+ * in_altvoltage*. Labels tell what each channel actually is.
+ */
+#define NCHANNELS_IIO (NCHANNELS_TEMP + NCHANNELS_POWER + NCHANNELS_FREQ)
+
+struct amdgpu_metrics_iio {
+	struct amdgpu_metrics_private *priv;
+	/* One u32 per channel, followed by a naturally aligned s64 timestamp. */
+	u32 scan[ALIGN(NCHANNELS_IIO, 2) + 2] __aligned(8);
+};
+
+/* Must be called with metrics_lock held. */
+static int amdgpu_metrics_iio_get_raw(struct amdgpu_metrics_private *priv,
+				      const struct iio_chan_spec *chan, uint64_t *raw)
+{
+	switch (chan->type) {
+	case IIO_TEMP:
+		return GET_TEMP(&priv->common, chan->address, raw);
+	case IIO_POWER:
+		return GET_POWER(&priv->common, chan->address, raw);
+	case IIO_ALTVOLTAGE:
+		return GET_FREQ(&priv->common, chan->address, raw);
+	default:
+		return -EINVAL;
+	}
+}
+
+static int amdgpu_metrics_iio_read_raw(struct iio_dev *indio_dev,
+				       const struct iio_chan_spec *chan,
+				       int *val, int *val2, long mask)
+{
+	struct amdgpu_metrics_iio *iio = iio_priv(indio_dev);
+	struct amdgpu_metrics_private *priv = iio->priv;
+	uint64_t raw;
+	int err;
+
+	switch (mask) {
+	case IIO_CHAN_INFO_RAW:
+		if (amdgpu_metrics_update_gpu_metrics(priv, false) < 0)
+			return -EIO;
+
+		scoped_guard(rwsem_read, &priv->refresh.metrics_lock)
+			err = amdgpu_metrics_iio_get_raw(priv, chan, &raw);
+		if (err)
+			return err;
+
+		*val = raw;
+		return IIO_VAL_INT;
+	case IIO_CHAN_INFO_SCALE:
+		/* Same units as HWMON, except that IIO power is in mW. */
+		switch (chan->type) {
+		case IIO_TEMP:
+			*val = GET_MULTIPLIER(hwmon_temp);
+			return IIO_VAL_INT;
+		case IIO_POWER:
+			*val = 1;
+			return IIO_VAL_INT;
+		case IIO_ALTVOLTAGE:
+			*val = GET_MULTIPLIER(hwmon_magic_freq);
+			return IIO_VAL_INT;
+		default:
+			return -EINVAL;
+		}
+	default:
+		return -EINVAL;
+	}
+}
+
+static int amdgpu_metrics_iio_read_label(struct iio_dev *indio_dev,
+					 const struct iio_chan_spec *chan, char *label)
+{
+	struct amdgpu_metrics_iio *iio = iio_priv(indio_dev);
+	const struct amdgpu_metrics_labels_remap *remap = &iio->priv->common.remap;
+
+	switch (chan->type) {
+	case IIO_TEMP:
+		return sysfs_emit(label, "%s\n",
+				  amdgpu_metrics_labels_temp[remap->temp.data[chan->address].idx]);
+	case IIO_POWER:
+		return sysfs_emit(label, "%s\n",
+				  amdgpu_metrics_labels_power[remap->power.data[chan->address].idx]);
+	case IIO_ALTVOLTAGE:
+		return sysfs_emit(label, "%s\n",
+				  amdgpu_metrics_labels_freq[remap->freq.data[chan->address].idx]);
+	default:
+		return -EINVAL;
+	}
+}
+
+static const struct iio_info amdgpu_metrics_iio_info = {
+	.read_raw = amdgpu_metrics_iio_read_raw,
+	.read_label = amdgpu_metrics_iio_read_label,
+};
+
+static irqreturn_t amdgpu_metrics_iio_trigger_handler(int irq, void *p)
+{
+	struct iio_poll_func *pf = p;
+	struct iio_dev *indio_dev = pf->indio_dev;
+	struct amdgpu_metrics_iio *iio = iio_priv(indio_dev);
+	struct amdgpu_metrics_private *priv = iio->priv;
+	unsigned int bit, i = 0;
+	uint64_t raw;
+
+	/* The trigger decides the sampling rate, not UPDATE_INTERVAL_MS. */
+	if (amdgpu_metrics_update_gpu_metrics(priv, true) < 0)
 		goto out;
 
-	channel = priv->per_core_channel_remap[channel].idx;
+	scoped_guard(rwsem_read, &priv->refresh.metrics_lock) {
+		iio_for_each_active_channel(indio_dev, bit) {
+			if (indio_dev->channels[bit].type == IIO_TIMESTAMP)
+				continue;
+			if (amdgpu_metrics_iio_get_raw(priv, &indio_dev->channels[bit], &raw))
+				raw = U32_MAX;
+			iio->scan[i++] = raw;
+		}
+	}
 
-	if (type == hwmon_temp)
-		visible = priv->common.remap.temp.core[channel].valid;
-	else if (type == hwmon_power)
-		visible = priv->common.remap.power.core[channel].valid;
-	else if (type == hwmon_magic_freq)
-		visible = priv->common.remap.freq.coreclk[channel].valid;
+	iio_push_to_buffers_with_timestamp(indio_dev, iio->scan, pf->timestamp);
 
 out:
-	return visible ? 0444 : 0;
+	iio_trigger_notify_done(indio_dev->trig);
+	return IRQ_HANDLED;
 }
 
-static umode_t amdgpu_metrics_hwmon_visible_shim(struct kobject *kobj,
-						 struct attribute *attr, int index)
+static unsigned int __init amdgpu_metrics_iio_add_channels(struct iio_chan_spec *chans,
+							   unsigned int n,
+							   enum iio_chan_type type,
+							   const remap_t *remaps, size_t size)
 {
-	const void *drvdata = dev_get_drvdata(kobj_to_dev(kobj));
-	struct device_attribute *dev_attr = container_of(attr, struct device_attribute, attr);
-	struct sensor_device_attribute_2 *sensor_attr = to_sensor_dev_attr_2(dev_attr);
-	bool visible;
+	unsigned int i;
+
+	for (i = 0; i < size; i++) {
+		if (!remaps[i].valid)
+			continue;
 
-	visible = sensor_attr->index == hwmon_magic_freq_idx_per_core
-		? amdgpu_metrics_per_core_is_visible(drvdata, hwmon_magic_freq,
-						     0, sensor_attr->nr - 1)
-		: amdgpu_metrics_hwmon_is_visible(drvdata, hwmon_magic_freq,
-						  0, sensor_attr->nr - 1);
+		chans[n] = (struct iio_chan_spec) {
+			.type = type,
+			.indexed = 1,
+			.channel = i,
+			.address = i,
+			.info_mask_separate = BIT(IIO_CHAN_INFO_RAW),
+			.info_mask_shared_by_type = BIT(IIO_CHAN_INFO_SCALE),
+			.scan_index = n,
+			.scan_type = {
+				.sign = 'u',
+				.realbits = 32,
+				.storagebits = 32,
+				.endianness = IIO_CPU,
+			},
+		};
+		n++;
+	}
 
-	return visible ? attr->mode : 0;
+	return n;
 }
 
-static int amdgpu_metrics_hwmon_read_string(struct device *dev, enum hwmon_sensor_types type,
-					    u32 attr, int channel, const char **str)
+static int __init amdgpu_metrics_register_iio(struct amdgpu_metrics_private *priv)
 {
-	struct amdgpu_metrics_private *priv = dev_get_drvdata(dev);
+	struct amdgpu_metrics_iio *iio;
+	struct iio_chan_spec *chans;
+	struct iio_dev *indio_dev;
+	unsigned int n = 0;
+	int err;
 
-	if (type == hwmon_temp && attr == hwmon_temp_label)
-		*str = amdgpu_metrics_labels_temp[priv->common.remap.temp.data[channel].idx];
-	else if (type == hwmon_power && attr == hwmon_power_label)
-		*str = amdgpu_metrics_labels_power[priv->common.remap.power.data[channel].idx];
-	else if (type == hwmon_magic_freq && attr == hwmon_magic_freq_label)
-		*str = amdgpu_metrics_labels_freq[priv->common.remap.freq.data[channel].idx];
-	else
-		return -EOPNOTSUPP;
+	indio_dev = devm_iio_device_alloc(amdgpu_metrics_device, sizeof(*iio));
+	if (indio_dev == NULL)
+		return -ENOMEM;
 
-	return 0;
-}
+	iio = iio_priv(indio_dev);
+	iio->priv = priv;
 
-static ssize_t amdgpu_metrics_hwmon_label_shim(struct device *dev, struct device_attribute *attr,
-					       char *buf)
-{
-	struct sensor_device_attribute_2 *sensor_attr = to_sensor_dev_attr_2(attr);
-	const char *label;
-	int err;
+	/* +1 for the timestamp */
+	chans = devm_kcalloc(amdgpu_metrics_device, NCHANNELS_IIO + 1, sizeof(*chans), GFP_KERNEL);
+	if (chans == NULL)
+		return -ENOMEM;
+
+	n = amdgpu_metrics_iio_add_channels(chans, n, IIO_TEMP,
+					    priv->common.remap.temp.data, NCHANNELS_TEMP);
+	n = amdgpu_metrics_iio_add_channels(chans, n, IIO_POWER,
+					    priv->common.remap.power.data, NCHANNELS_POWER);
+	n = amdgpu_metrics_iio_add_channels(chans, n, IIO_ALTVOLTAGE,
+					    priv->common.remap.freq.data, NCHANNELS_FREQ);
+	chans[n] = (struct iio_chan_spec) IIO_CHAN_SOFT_TIMESTAMP(n);
+
+	indio_dev->name = MODULE_NAME;
+	indio_dev->info = &amdgpu_metrics_iio_info;
+	indio_dev->modes = INDIO_DIRECT_MODE;
+	indio_dev->channels = chans;
+	indio_dev->num_channels = n + 1;
+
+	err = devm_iio_triggered_buffer_setup(amdgpu_metrics_device, indio_dev,
+					      iio_pollfunc_store_time,
+					      amdgpu_metrics_iio_trigger_handler, NULL);
+	if (err) {
+		pr_err("Failed to set up IIO triggered buffer: %d\n", err);
+		return err;
+	}
 
-	err = amdgpu_metrics_hwmon_read_string(dev, hwmon_magic_freq, hwmon_magic_freq_label,
-					       sensor_attr->nr - 1, &label);
+	err = devm_iio_device_register(amdgpu_metrics_device, indio_dev);
+	if (err)
+		pr_err("Failed to register IIO device: %d\n", err);
 
-	return err ?: sysfs_emit(buf, "%s\n", label);
+	return err;
 }
 
-static ssize_t amdgpu_metrics_read_gpu_metrics(const char *path,
-					       struct metrics_table_header *metrics,
-					       size_t buf_size)
-{
-	struct file *filp;
-	ssize_t ret;
+#else /* !IS_REACHABLE(CONFIG_IIO_TRIGGERED_BUFFER) */
 
-	filp = filp_open(path, O_RDONLY, 0);
-	if (IS_ERR(filp)) {
-		pr_err("Failed to open %s\n", path);
-		return PTR_ERR(filp);
-	}
+static int __init amdgpu_metrics_register_iio(struct amdgpu_metrics_private *priv)
+{
+	pr_err("IIO triggered buffer support is not available in this kernel\n");
+	return -EOPNOTSUPP;
+}
 
-	ret = kernel_read(filp, metrics, buf_size, NULL);
-	filp_close(filp, NULL);
+#endif /* IS_REACHABLE(CONFIG_IIO_TRIGGERED_BUFFER) */
 
-	if (ret < 0) {
-		pr_err("Failed to read GPU metrics: %zd\n", ret);
-		return ret;
-	}
+static void amdgpu_metrics_sample_work(struct work_struct *work)
+{
+	struct amdgpu_metrics_private *priv = container_of(to_delayed_work(work),
+							   struct amdgpu_metrics_private,
+							   sample_work);
 
-	if (ret < sizeof(struct metrics_table_header)) {
-		pr_err("Invalid GPU metrics size: %zd < %lu\n",
-		       ret, sizeof(struct metrics_table_header));
-		return -EIO;
-	}
+	amdgpu_metrics_update_gpu_metrics(priv, true);
+	schedule_delayed_work(&priv->sample_work, msecs_to_jiffies(sample_interval_ms));
+}
 
-	if (ret != metrics->structure_size) {
-		pr_err("GPU metrics size mismatch: read %zd, declared %d\n",
-		       ret, metrics->structure_size);
-		return -EIO;
-	}
+static void amdgpu_metrics_sample_stop(void *data)
+{
+	struct amdgpu_metrics_private *priv = data;
 
-	return ret;
+	cancel_delayed_work_sync(&priv->sample_work);
 }
 
-/*
- * <0: error
- * 0: no need to update
- * >0: updated
- */
-static int amdgpu_metrics_update_gpu_metrics(struct amdgpu_metrics_private *priv)
+static int __init amdgpu_metrics_sample_start(struct amdgpu_metrics_private *priv)
 {
-	ssize_t size;
+	INIT_DELAYED_WORK(&priv->sample_work, amdgpu_metrics_sample_work);
+	schedule_delayed_work(&priv->sample_work, 0);
 
-	if (time_before(jiffies, priv->last_update_jiffies + UPDATE_INTERVAL_JIFFIES))
-		return 0;
+	return devm_add_action_or_reset(amdgpu_metrics_device, amdgpu_metrics_sample_stop, priv);
+}
 
-	guard(rwsem_write)(&priv->metrics_lock);
+static void amdgpu_metrics_history_free(void *prev)
+{
+	kvfree(prev);
+}
 
-	size = amdgpu_metrics_read_gpu_metrics(priv->path, &priv->common.metrics.header,
-					       priv->common.channels->metrics_size);
-	if (size < 0)
-		return size;
+static int __init amdgpu_metrics_history_init(struct amdgpu_metrics_private *priv)
+{
+	size_t size = priv->common.channels->metrics_size;
+	size_t keyframe_size = AMDGPU_METRICS_HISTORY_RECORD_SIZE(size);
+	unsigned int nkeyframes;
+
+	priv->history.depth = history_depth;
+
+	if (history_kb) {
+		priv->history.capacity = (size_t)history_kb * 1024;
+	} else {
+		/* Deltas take at most about half a table, see "utilities -z". */
+		nkeyframes = DIV_ROUND_UP(history_depth, max(history_keyframe_interval, 1U));
+		priv->history.capacity =
+			nkeyframes * keyframe_size +
+			(history_depth - nkeyframes) * AMDGPU_METRICS_HISTORY_RECORD_SIZE(size / 2);
+	}
+	/* Always have room for a keyframe and a delta against it. */
+	priv->history.capacity = ALIGN(max(priv->history.capacity, 2 * keyframe_size), 8);
 
-	if (size != priv->common.channels->metrics_size)
-		return -EIO;
+	priv->history.prev = kvzalloc(ALIGN(size, 8) + priv->history.capacity, GFP_KERNEL);
+	if (priv->history.prev == NULL) {
+		priv->history.depth = 0;
+		return -ENOMEM;
+	}
+	priv->history.ring = priv->history.prev + ALIGN(size, 8);
+	priv->history.wrap = priv->history.capacity;
 
-	priv->last_update_jiffies = jiffies;
+	pr_debug("Flight recorder: %u snapshots, %zu bytes\n",
+		 priv->history.depth, priv->history.capacity);
 
-	return 1;
+	return devm_add_action_or_reset(amdgpu_metrics_device, amdgpu_metrics_history_free,
+					priv->history.prev);
 }
 
-/*
- * Temp: centi-Celsius to milli-Celsius
- * Power: mW to uW
- * Freq: MHz to Hz
- */
-#define GET_MULTIPLIER(_hwmon_type)			\
-	((_hwmon_type) == hwmon_temp ? 10 :		\
-	 (_hwmon_type) == hwmon_power ? 1000 :		\
-	 (_hwmon_type) == hwmon_magic_freq ? 1000000 :	\
-	 0)
+struct amdgpu_metrics_blob {
+	size_t size;
+	uint8_t data[];
+};
 
-static int amdgpu_metrics_hwmon_read(struct device *dev, enum hwmon_sensor_types type,
-				     u32 attr, int channel, long *val)
+static int amdgpu_metrics_history_open(struct inode *inode, struct file *file)
 {
-	struct amdgpu_metrics_private *priv = dev_get_drvdata(dev);
-	int err = -EOPNOTSUPP;
-	uint64_t raw;
-	uint32_t multiplier = GET_MULTIPLIER(type);
-
-	if (WARN_ON(multiplier == 0))
-		return err;
+	struct amdgpu_metrics_private *priv = inode->i_private;
+	struct amdgpu_metrics_history_header *header;
+	struct amdgpu_metrics_blob *blob;
+	size_t first, second;
+
+	/* Take a consistent copy, so that readers don't block refreshing. */
+	guard(rwsem_read)(&priv->refresh.metrics_lock);
+
+	/* Oldest first */
+	if (!priv->history.count) {
+		first = second = 0;
+	} else if (priv->history.tail < priv->history.head) {
+		first = priv->history.head - priv->history.tail;
+		second = 0;
+	} else {
+		first = priv->history.wrap - priv->history.tail;
+		second = priv->history.head;
+	}
 
-	if (amdgpu_metrics_update_gpu_metrics(priv) < 0)
-		return -EIO;
+	blob = kvmalloc(struct_size(blob, data, sizeof(*header) + first + second), GFP_KERNEL);
+	if (blob == NULL)
+		return -ENOMEM;
 
-	guard(rwsem_read)(&priv->metrics_lock);
+	blob->size = sizeof(*header) + first + second;
 
-	if (type == hwmon_temp && attr == hwmon_temp_input)
-		err = GET_TEMP(&priv->common, channel, &raw);
-	else if (type == hwmon_power && attr == hwmon_power_input)
-		err = GET_POWER(&priv->common, channel, &raw);
-	else if (type == hwmon_magic_freq && attr == hwmon_magic_freq_input)
-		err = GET_FREQ(&priv->common, channel, &raw);
+	header = (struct amdgpu_metrics_history_header *)blob->data;
+	*header = (struct amdgpu_metrics_history_header) {
+		.magic = AMDGPU_METRICS_HISTORY_MAGIC,
+		.version = AMDGPU_METRICS_HISTORY_VERSION,
+		.flags = READ_ONCE(priv->history.frozen) ? AMDGPU_METRICS_HISTORY_FROZEN : 0,
+		.nr_records = priv->history.count,
+	};
 
-	if (err)
-		return err;
+	memcpy((void *)(header + 1), priv->history.ring + priv->history.tail, first);
+	memcpy((void *)(header + 1) + first, priv->history.ring, second);
 
-	*val = raw * multiplier;
+	file->private_data = blob;
 	return 0;
 }
 
-static int amdgpu_metrics_per_core_read(struct device *dev, enum hwmon_sensor_types type,
-					u32 attr, int channel, long *val)
+static ssize_t amdgpu_metrics_blob_read(struct file *file, char __user *buf,
+					size_t count, loff_t *ppos)
 {
-	struct amdgpu_metrics_private *priv = dev_get_drvdata(dev);
-	int err = -EOPNOTSUPP;
-	uint64_t raw;
-	uint32_t multiplier = GET_MULTIPLIER(type);
+	struct amdgpu_metrics_blob *blob = file->private_data;
 
-	if (WARN_ON(multiplier == 0 || channel >= NCORES))
-		return err;
+	return simple_read_from_buffer(buf, count, ppos, blob->data, blob->size);
+}
 
-	if (amdgpu_metrics_update_gpu_metrics(priv) < 0)
-		return -EIO;
+static int amdgpu_metrics_blob_release(struct inode *inode, struct file *file)
+{
+	kvfree(file->private_data);
+	return 0;
+}
 
-	channel = priv->per_core_channel_remap[channel].idx;
+static const struct file_operations amdgpu_metrics_history_fops = {
+	.owner = THIS_MODULE,
+	.open = amdgpu_metrics_history_open,
+	.read = amdgpu_metrics_blob_read,
+	.release = amdgpu_metrics_blob_release,
+	.llseek = default_llseek,
+};
 
-	guard(rwsem_read)(&priv->metrics_lock);
+static int amdgpu_metrics_companion_open(struct inode *inode, struct file *file)
+{
+	struct amdgpu_metrics_companion_table *table = inode->i_private;
+	struct amdgpu_metrics_blob *blob;
 
-	if (type == hwmon_temp && attr == hwmon_temp_input)
-		err = GET_CORE_TEMP(&priv->common, channel, &raw);
-	else if (type == hwmon_power && attr == hwmon_power_input)
-		err = GET_CORE_POWER(&priv->common, channel, &raw);
-	else if (type == hwmon_magic_freq && attr == hwmon_magic_freq_input)
-		err = GET_CORE_FREQ(&priv->common, channel, &raw);
+	/* Take a consistent copy, so that readers don't block refreshing. */
+	guard(rwsem_read)(&table->priv->refresh.metrics_lock);
 
-	if (err)
-		return err;
+	if (!table->size)
+		return -ENODATA;
+
+	blob = kvmalloc(struct_size(blob, data, table->size), GFP_KERNEL);
+	if (blob == NULL)
+		return -ENOMEM;
+
+	blob->size = table->size;
+	memcpy(blob->data, table->buf, blob->size);
 
-	*val = raw * multiplier;
+	file->private_data = blob;
 	return 0;
 }
 
-static ssize_t amdgpu_metrics_hwmon_input_shim(struct device *dev, struct device_attribute *attr,
-					       char *buf)
+static const struct file_operations amdgpu_metrics_companion_fops = {
+	.owner = THIS_MODULE,
+	.open = amdgpu_metrics_companion_open,
+	.read = amdgpu_metrics_blob_read,
+	.release = amdgpu_metrics_blob_release,
+	.llseek = default_llseek,
+};
+
+static int amdgpu_metrics_stats_show(struct seq_file *m, void *unused)
 {
-	struct sensor_device_attribute_2 *sensor_attr = to_sensor_dev_attr_2(attr);
-	long val;
-	int err;
+	struct amdgpu_metrics_private *priv = m->private;
+	struct amdgpu_metrics_stats sum = { 0 }, *stats;
+	unsigned int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		stats = per_cpu_ptr(priv->stats, cpu);
+		sum.reads += stats->reads;
+		sum.refreshes += stats->refreshes;
+		sum.skipped += stats->skipped;
+		sum.errors += stats->errors;
+		sum.companion_errors += stats->companion_errors;
+		sum.throttled += stats->throttled;
+		sum.lock_wait_ns += stats->lock_wait_ns;
+		for (i = 0; i < NLATENCY_BUCKETS; i++)
+			sum.latency[i] += stats->latency[i];
+	}
 
-	err = sensor_attr->index == hwmon_magic_freq_idx_per_core
-		? amdgpu_metrics_per_core_read(dev, hwmon_magic_freq, hwmon_magic_freq_input,
-					       sensor_attr->nr - 1, &val)
-		: amdgpu_metrics_hwmon_read(dev, hwmon_magic_freq, hwmon_magic_freq_input,
-					    sensor_attr->nr - 1, &val);
+	seq_printf(m, "reads: %llu\n", sum.reads);
+	seq_printf(m, "refreshes: %llu\n", sum.refreshes);
+	seq_printf(m, "skipped: %llu\n", sum.skipped);
+	seq_printf(m, "errors: %llu\n", sum.errors);
+	seq_printf(m, "companion_errors: %llu\n", sum.companion_errors);
+	seq_printf(m, "throttled: %llu\n", sum.throttled);
+	seq_printf(m, "lock_wait_ns: %llu\n", sum.lock_wait_ns);
+	seq_puts(m, "latency_ns:\n");
+	for (i = 0; i < NLATENCY_BUCKETS; i++) {
+		if (sum.latency[i])
+			seq_printf(m, "  [%llu, %llu): %llu\n",
+				   i ? 1ULL << i : 0, 1ULL << (i + 1), sum.latency[i]);
+	}
 
-	return err ?: sysfs_emit(buf, "%ld\n", val);
+	return 0;
 }
 
-#define PREFIXED_SENSOR_DEVICE_ATTR_2_RO(_prefix, _name, _func, _nr, _index)	\
-struct sensor_device_attribute_2 sensor_dev_attr_ ##_prefix ##_ ##_name		\
-	= SENSOR_ATTR_2(_name, 0444, _func, NULL, _nr, _index)
+/* Write anything to reset. Increments racing with resetting may be lost. */
+static ssize_t amdgpu_metrics_stats_write(struct file *file, const char __user *buf,
+					  size_t count, loff_t *ppos)
+{
+	struct seq_file *m = file->private_data;
+	struct amdgpu_metrics_private *priv = m->private;
+	unsigned int cpu;
 
-#define MAIN_SENSOR_DEVICE_ATTR(_name, _nr)					\
-static PREFIXED_SENSOR_DEVICE_ATTR_2_RO(hwmon, _name ##_nr ##_label,		\
-	amdgpu_metrics_hwmon_label_shim, _nr, hwmon_magic_freq_idx_main);	\
-static PREFIXED_SENSOR_DEVICE_ATTR_2_RO(hwmon, _name ##_nr ##_input,		\
-	amdgpu_metrics_hwmon_input_shim, _nr, hwmon_magic_freq_idx_main)
-
-#define REF_MAIN_SENSOR_DEVICE_ATTR(_name, _nr)					\
-	&sensor_dev_attr_hwmon_ ##_name ##_nr ##_label.dev_attr.attr,		\
-	&sensor_dev_attr_hwmon_ ##_name ##_nr ##_input.dev_attr.attr
-
-MAIN_SENSOR_DEVICE_ATTR(freq, 1);
-MAIN_SENSOR_DEVICE_ATTR(freq, 2);
-MAIN_SENSOR_DEVICE_ATTR(freq, 3);
-MAIN_SENSOR_DEVICE_ATTR(freq, 4);
-MAIN_SENSOR_DEVICE_ATTR(freq, 5);
-MAIN_SENSOR_DEVICE_ATTR(freq, 6);
-MAIN_SENSOR_DEVICE_ATTR(freq, 7);
-MAIN_SENSOR_DEVICE_ATTR(freq, 8);
-MAIN_SENSOR_DEVICE_ATTR(freq, 9);
-MAIN_SENSOR_DEVICE_ATTR(freq, 10);
-MAIN_SENSOR_DEVICE_ATTR(freq, 11);
-MAIN_SENSOR_DEVICE_ATTR(freq, 12);
-MAIN_SENSOR_DEVICE_ATTR(freq, 13);
-MAIN_SENSOR_DEVICE_ATTR(freq, 14);
-MAIN_SENSOR_DEVICE_ATTR(freq, 15);
-MAIN_SENSOR_DEVICE_ATTR(freq, 16);
-MAIN_SENSOR_DEVICE_ATTR(freq, 17);
-MAIN_SENSOR_DEVICE_ATTR(freq, 18);
-MAIN_SENSOR_DEVICE_ATTR(freq, 19);
-MAIN_SENSOR_DEVICE_ATTR(freq, 20);
-MAIN_SENSOR_DEVICE_ATTR(freq, 21);
-MAIN_SENSOR_DEVICE_ATTR(freq, 22);
-MAIN_SENSOR_DEVICE_ATTR(freq, 23);
-MAIN_SENSOR_DEVICE_ATTR(freq, 24);
-MAIN_SENSOR_DEVICE_ATTR(freq, 25);
-MAIN_SENSOR_DEVICE_ATTR(freq, 26);
-MAIN_SENSOR_DEVICE_ATTR(freq, 27);
-MAIN_SENSOR_DEVICE_ATTR(freq, 28);
-MAIN_SENSOR_DEVICE_ATTR(freq, 29);
-MAIN_SENSOR_DEVICE_ATTR(freq, 30);
-MAIN_SENSOR_DEVICE_ATTR(freq, 31);
-MAIN_SENSOR_DEVICE_ATTR(freq, 32);
-MAIN_SENSOR_DEVICE_ATTR(freq, 33);
-MAIN_SENSOR_DEVICE_ATTR(freq, 34);
-MAIN_SENSOR_DEVICE_ATTR(freq, 35);
-MAIN_SENSOR_DEVICE_ATTR(freq, 36);
-MAIN_SENSOR_DEVICE_ATTR(freq, 37);
-MAIN_SENSOR_DEVICE_ATTR(freq, 38);
-MAIN_SENSOR_DEVICE_ATTR(freq, 39);
-MAIN_SENSOR_DEVICE_ATTR(freq, 40);
-MAIN_SENSOR_DEVICE_ATTR(freq, 41);
-MAIN_SENSOR_DEVICE_ATTR(freq, 42);
-MAIN_SENSOR_DEVICE_ATTR(freq, 43);
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(priv->stats, cpu), 0, sizeof(struct amdgpu_metrics_stats));
 
-static const struct hwmon_channel_info *const amdgpu_metrics_hwmon_info[] = {
-	HWMON_CHANNEL_INFO(temp, REPEAT_NCHANNELS_TEMP(HWMON_T_INPUT | HWMON_T_LABEL)),
-	HWMON_CHANNEL_INFO(power, REPEAT_NCHANNELS_POWER(HWMON_P_INPUT | HWMON_P_LABEL)),
-	NULL
-};
+	return count;
+}
 
-static struct attribute *amdgpu_metrics_hwmon_attributes[] = {
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 1),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 2),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 3),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 4),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 5),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 6),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 7),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 8),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 9),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 10),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 11),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 12),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 13),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 14),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 15),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 16),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 17),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 18),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 19),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 20),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 21),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 22),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 23),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 24),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 25),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 26),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 27),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 28),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 29),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 30),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 31),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 32),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 33),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 34),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 35),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 36),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 37),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 38),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 39),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 40),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 41),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 42),
-	REF_MAIN_SENSOR_DEVICE_ATTR(freq, 43),
-	NULL
-};
+DEFINE_SHOW_STORE_ATTRIBUTE(amdgpu_metrics_stats);
 
-static const struct attribute_group amdgpu_metrics_hwmon_attrgroup = {
-	.attrs = amdgpu_metrics_hwmon_attributes,
-	.is_visible = amdgpu_metrics_hwmon_visible_shim,
-};
+/* Memory allocated by this module for the device, in bytes */
+static int amdgpu_metrics_memory_show(struct seq_file *m, void *unused)
+{
+	struct amdgpu_metrics_private *priv = m->private;
+	size_t metrics = priv->common.channels->metrics_size;
+	size_t stats = sizeof(struct amdgpu_metrics_stats) * num_possible_cpus();
+	size_t history = 0, companions = 0;
+	unsigned int i;
+
+	for (i = 0; i < NCOMPANIONS; i++)
+		companions += priv->companions[i].capacity;
+
+	if (priv->history.depth)
+		history = ALIGN(metrics, 8) + priv->history.capacity;
+
+	seq_printf(m, "private: %zu\n", sizeof(*priv));
+	seq_printf(m, "metrics: %zu\n", metrics);
+	seq_printf(m, "companions: %zu\n", companions);
+	seq_printf(m, "attributes: %zu\n", priv->ext_attr_bytes);
+	seq_printf(m, "stats: %zu\n", stats);
+	seq_printf(m, "history: %zu\n", history);
+	seq_printf(m, "total: %zu\n", sizeof(*priv) + metrics + companions +
+		   priv->ext_attr_bytes + stats + history);
 
-static const struct attribute_group *amdgpu_metrics_hwmon_attrgroups[] = {
-	&amdgpu_metrics_hwmon_attrgroup,
-	NULL
-};
+	return 0;
+}
 
-static const struct hwmon_ops amdgpu_metrics_hwmon_ops = {
-	.is_visible = amdgpu_metrics_hwmon_is_visible,
-	.read = amdgpu_metrics_hwmon_read,
-	.read_string = amdgpu_metrics_hwmon_read_string,
-};
+DEFINE_SHOW_ATTRIBUTE(amdgpu_metrics_memory);
 
-static const struct hwmon_chip_info amdgpu_metrics_hwmon_chip_info = {
-	.ops = &amdgpu_metrics_hwmon_ops,
-	.info = amdgpu_metrics_hwmon_info,
-};
+static int amdgpu_metrics_budget_show(struct seq_file *m, void *unused)
+{
+	guard(spinlock)(&amdgpu_metrics_budget.lock);
 
-#define PER_CORE_SENSOR_DEVICE_ATTR(_name, _nr)					\
-static PREFIXED_SENSOR_DEVICE_ATTR_2_RO(per_core, _name ##_nr ##_input,		\
-	amdgpu_metrics_hwmon_input_shim, _nr, hwmon_magic_freq_idx_per_core)
-
-#define REF_PRE_CORE_SENSOR_DEVICE_ATTR(_name, _nr)				\
-	&sensor_dev_attr_per_core_ ##_name ##_nr ##_input.dev_attr.attr
-
-PER_CORE_SENSOR_DEVICE_ATTR(freq, 1);
-PER_CORE_SENSOR_DEVICE_ATTR(freq, 2);
-PER_CORE_SENSOR_DEVICE_ATTR(freq, 3);
-PER_CORE_SENSOR_DEVICE_ATTR(freq, 4);
-PER_CORE_SENSOR_DEVICE_ATTR(freq, 5);
-PER_CORE_SENSOR_DEVICE_ATTR(freq, 6);
-PER_CORE_SENSOR_DEVICE_ATTR(freq, 7);
-PER_CORE_SENSOR_DEVICE_ATTR(freq, 8);
-PER_CORE_SENSOR_DEVICE_ATTR(freq, 9);
-PER_CORE_SENSOR_DEVICE_ATTR(freq, 10);
-PER_CORE_SENSOR_DEVICE_ATTR(freq, 11);
-PER_CORE_SENSOR_DEVICE_ATTR(freq, 12);
-PER_CORE_SENSOR_DEVICE_ATTR(freq, 13);
-PER_CORE_SENSOR_DEVICE_ATTR(freq, 14);
-PER_CORE_SENSOR_DEVICE_ATTR(freq, 15);
-PER_CORE_SENSOR_DEVICE_ATTR(freq, 16);
-
-static struct attribute *amdgpu_metrics_per_core_attributes[] = {
-	REF_PRE_CORE_SENSOR_DEVICE_ATTR(freq, 1),
-	REF_PRE_CORE_SENSOR_DEVICE_ATTR(freq, 2),
-	REF_PRE_CORE_SENSOR_DEVICE_ATTR(freq, 3),
-	REF_PRE_CORE_SENSOR_DEVICE_ATTR(freq, 4),
-	REF_PRE_CORE_SENSOR_DEVICE_ATTR(freq, 5),
-	REF_PRE_CORE_SENSOR_DEVICE_ATTR(freq, 6),
-	REF_PRE_CORE_SENSOR_DEVICE_ATTR(freq, 7),
-	REF_PRE_CORE_SENSOR_DEVICE_ATTR(freq, 8),
-	REF_PRE_CORE_SENSOR_DEVICE_ATTR(freq, 9),
-	REF_PRE_CORE_SENSOR_DEVICE_ATTR(freq, 10),
-	REF_PRE_CORE_SENSOR_DEVICE_ATTR(freq, 11),
-	REF_PRE_CORE_SENSOR_DEVICE_ATTR(freq, 12),
-	REF_PRE_CORE_SENSOR_DEVICE_ATTR(freq, 13),
-	REF_PRE_CORE_SENSOR_DEVICE_ATTR(freq, 14),
-	REF_PRE_CORE_SENSOR_DEVICE_ATTR(freq, 15),
-	REF_PRE_CORE_SENSOR_DEVICE_ATTR(freq, 16),
-	NULL
-};
+	seq_printf(m, "rate: %u\n", READ_ONCE(smu_read_rate));
+	seq_printf(m, "burst: %u\n", READ_ONCE(smu_read_burst));
+	seq_printf(m, "granted: %llu\n", amdgpu_metrics_budget.granted);
+	seq_printf(m, "throttled: %llu\n", amdgpu_metrics_budget.throttled);
 
-static const struct attribute_group amdgpu_metrics_per_core_attrgroup = {
-	.attrs = amdgpu_metrics_per_core_attributes,
-	.is_visible = amdgpu_metrics_hwmon_visible_shim,
-};
+	return 0;
+}
 
-static const struct attribute_group *amdgpu_metrics_per_core_attrgroups[] = {
-	&amdgpu_metrics_per_core_attrgroup,
-	NULL
-};
+DEFINE_SHOW_ATTRIBUTE(amdgpu_metrics_budget);
 
-/*
- * Labels are intentional not exported, in order that HTOP can correctly
- * display core temperature on multi cluster (e.g., big.LITTLE) CPUs.
- */
-static const struct hwmon_channel_info *const amdgpu_metrics_per_core_info[] = {
-	HWMON_CHANNEL_INFO(temp, REPEAT_NCORES(HWMON_T_INPUT)),
-	HWMON_CHANNEL_INFO(power, REPEAT_NCORES(HWMON_P_INPUT)),
-	NULL
-};
+static struct dentry *amdgpu_metrics_debugfs_root;
 
-static const struct hwmon_ops amdgpu_metrics_per_core_ops = {
-	.is_visible = amdgpu_metrics_per_core_is_visible,
-	.read = amdgpu_metrics_per_core_read,
-};
+static void __init amdgpu_metrics_debugfs_init(struct amdgpu_metrics_private *priv)
+{
+	int i;
 
-static const struct hwmon_chip_info amdgpu_metrics_per_core_chip_info = {
-	.ops = &amdgpu_metrics_per_core_ops,
-	.info = amdgpu_metrics_per_core_info,
-};
+	priv->debugfs_dir = debugfs_create_dir(dev_name(priv->hwmon_dev),
+					       amdgpu_metrics_debugfs_root);
 
-/*
- * An HWMON device must be registered with a parent.
- * We have no choice but to create a dummy one.
- */
-static struct class *amdgpu_metrics_class;
-static struct device *amdgpu_metrics_device;
+	debugfs_create_file("stats", 0600, priv->debugfs_dir, priv, &amdgpu_metrics_stats_fops);
+	debugfs_create_file("memory", 0400, priv->debugfs_dir, priv, &amdgpu_metrics_memory_fops);
+
+	if (priv->history.depth) {
+		debugfs_create_file("history", 0400, priv->debugfs_dir, priv,
+				    &amdgpu_metrics_history_fops);
+		/* Write 0 to resume recording. */
+		debugfs_create_bool("history_frozen", 0600, priv->debugfs_dir,
+				    &priv->history.frozen);
+	}
+
+	for (i = 0; i < NCOMPANIONS; i++) {
+		if (priv->companions[i].buf)
+			debugfs_create_file(amdgpu_metrics_companions[i].name, 0400,
+					    priv->debugfs_dir, &priv->companions[i],
+					    &amdgpu_metrics_companion_fops);
+	}
+}
 
 static int __init amdgpu_metrics_init_priv(struct amdgpu_metrics_private *priv,
 					   bool separate_per_core)
@@ -577,10 +3351,51 @@ static int __init amdgpu_metrics_init_priv(struct amdgpu_metrics_private *priv,
 	return 0;
 }
 
+/*
+ * Fail early on a misconfigured path, rather than on each refresh. Buffers are
+ * sized to the first read, as tables don't change their sizes.
+ */
+static int __init amdgpu_metrics_companions_init(struct amdgpu_metrics_private *priv)
+{
+	void *buf;
+	ssize_t size;
+	int i;
+
+	for (i = 0; i < NCOMPANIONS; i++) {
+		if (amdgpu_metrics_companions[i].path[0] == '\0')
+			continue;
+
+		buf = kzalloc(COMPANION_MAX_SIZE, GFP_KERNEL);
+		if (buf == NULL)
+			return -ENOMEM;
+
+		size = amdgpu_metrics_read_table(amdgpu_metrics_companions[i].path,
+						 amdgpu_metrics_companions[i].name,
+						 buf, COMPANION_MAX_SIZE,
+						 amdgpu_metrics_companions[i].min_size, false);
+		if (size > 0)
+			priv->companions[i].buf = devm_kmemdup(amdgpu_metrics_device, buf, size,
+							       GFP_KERNEL);
+		kfree(buf);
+		if (size < 0)
+			return size;
+		if (priv->companions[i].buf == NULL)
+			return -ENOMEM;
+
+		priv->companions[i].priv = priv;
+		priv->companions[i].capacity = size;
+		priv->companions[i].size = size;
+	}
+
+	return 0;
+}
+
 static int __init amdgpu_metrics_register_path(const char *path)
 {
 	bool separate_per_core = per_core_hwmon_name[0] != '\0';
+	bool separate_npu = npu_hwmon_name[0] != '\0';
 	struct amdgpu_metrics_private *priv;
+	union gpu_metrics *metrics;
 	struct device *dev;
 	ssize_t size;
 	int err;
@@ -589,40 +3404,136 @@ static int __init amdgpu_metrics_register_path(const char *path)
 	if (priv == NULL)
 		return -ENOMEM;
 
-	size = amdgpu_metrics_read_gpu_metrics(path,
-					       &priv->common.metrics.header,
-					       sizeof(priv->common.metrics));
+	/* Sized for the largest revision until we know which one it is. */
+	metrics = kzalloc(sizeof(*metrics), GFP_KERNEL);
+	if (metrics == NULL) {
+		err = -ENOMEM;
+		goto out_free;
+	}
+
+	size = amdgpu_metrics_read_gpu_metrics(path, &metrics->header, sizeof(*metrics));
 	if (size < 0) {
+		kfree(metrics);
 		err = size;
 		goto out_free;
 	}
 
+	priv->common.metrics = metrics;
 	err = amdgpu_metrics_init_priv(priv, separate_per_core);
+	if (!err) {
+		priv->common.metrics = devm_kmemdup(amdgpu_metrics_device, metrics,
+						    priv->common.channels->metrics_size,
+						    GFP_KERNEL);
+		if (priv->common.metrics == NULL)
+			err = -ENOMEM;
+	}
+	kfree(metrics);
 	if (err)
 		goto out_free;
 
 	priv->path = path;
-	init_rwsem(&priv->metrics_lock);
+	amdgpu_metrics_refresh_init(&priv->refresh);
+
+	priv->stats = devm_alloc_percpu(amdgpu_metrics_device, struct amdgpu_metrics_stats);
+	if (priv->stats == NULL) {
+		err = -ENOMEM;
+		goto out_free;
+	}
+
+	err = amdgpu_metrics_companions_init(priv);
+	if (err)
+		goto out_free;
+
+	/* The first snapshot is the base of the first interval and edges. */
+	amdgpu_metrics_derived_update(priv);
+
+	if (separate_npu) {
+		err = amdgpu_metrics_npu_init(priv);
+		if (err)
+			goto out_free;
+	}
+
+	err = amdgpu_metrics_ext_init(priv);
+	if (err)
+		goto out_free;
+
+	amdgpu_metrics_init_attrgroups(priv);
+
+	if (history_depth) {
+		err = amdgpu_metrics_history_init(priv);
+		if (err)
+			goto out_free;
+	}
 
 	dev = devm_hwmon_device_register_with_info(amdgpu_metrics_device, MODULE_NAME,
 						   priv, &amdgpu_metrics_hwmon_chip_info,
-						   amdgpu_metrics_hwmon_attrgroups);
+						   priv->attrgroups);
 	err = PTR_ERR_OR_ZERO(dev);
 	if (err)
 		goto out_register_fail;
 
-	if (!separate_per_core || !priv->common.has_per_core)
-		return 0;
+	priv->hwmon_dev = dev;
 
-	dev = devm_hwmon_device_register_with_info(amdgpu_metrics_device, per_core_hwmon_name,
-						   priv, &amdgpu_metrics_per_core_chip_info,
-						   amdgpu_metrics_per_core_attrgroups);
-	err = PTR_ERR_OR_ZERO(dev);
+	if (separate_per_core && priv->common.has_per_core) {
+		err = amdgpu_metrics_per_core_init(priv);
+		if (err)
+			goto out_registered;
+
+		dev = devm_hwmon_device_register_with_info(amdgpu_metrics_device,
+							   per_core_hwmon_name, priv,
+							   &amdgpu_metrics_per_core_chip_info,
+							   priv->per_core_attrgroups);
+		err = PTR_ERR_OR_ZERO(dev);
+		if (err)
+			goto out_registered;
+	}
+
+	/* sysfs refuses empty groups. */
+	if (priv->npu_attrgroup.attrs) {
+		dev = devm_hwmon_device_register_with_groups(amdgpu_metrics_device,
+							     npu_hwmon_name, priv,
+							     priv->npu_attrgroups);
+		err = PTR_ERR_OR_ZERO(dev);
+		if (err)
+			goto out_registered;
+	}
+
+	err = amdgpu_metrics_register_xcps(priv);
 	if (err)
-		goto out_register_fail;
+		goto out_registered;
+
+	/*
+	 * Thermal zones, the IIO device and the sampler hold a reference to
+	 * priv until the dummy device goes away, so don't free priv on
+	 * failure. The caller destroys the device.
+	 */
+	if (sample_interval_ms) {
+		err = amdgpu_metrics_sample_start(priv);
+		if (err)
+			return err;
+	}
+
+	if (thermal_zones) {
+		err = amdgpu_metrics_register_thermal_zones(priv);
+		if (err)
+			return err;
+	}
+
+	if (iio) {
+		err = amdgpu_metrics_register_iio(priv);
+		if (err)
+			return err;
+	}
+
+	amdgpu_metrics_debugfs_init(priv);
 
 	return 0;
 
+out_registered:
+	/* Registered devices hold priv until the caller destroys the dummy device. */
+	pr_err("Failed to register HWMON device: %d\n", err);
+	return err;
+
 out_register_fail:
 	pr_err("Failed to register HWMON device: %d\n", err);
 	goto out_free;
@@ -634,6 +3545,7 @@ out_free:
 
 static int __init amdgpu_metrics_init(void)
 {
+	unsigned int i;
 	int err;
 
 	if (gpu_metrics_path[0] == '\0') {
@@ -641,6 +3553,17 @@ static int __init amdgpu_metrics_init(void)
 		return -EINVAL;
 	}
 
+	err = amdgpu_metrics_channel_groups_parse();
+	if (err)
+		return err;
+
+	for (i = 1; i < time_in_state_nbuckets; i++) {
+		if (time_in_state_mhz[i] <= time_in_state_mhz[i - 1]) {
+			pr_err("time_in_state_mhz must be ascending\n");
+			return -EINVAL;
+		}
+	}
+
 	amdgpu_metrics_class = class_create(MODULE_NAME);
 	err = PTR_ERR_OR_ZERO(amdgpu_metrics_class);
 	if (err) {
@@ -656,6 +3579,10 @@ static int __init amdgpu_metrics_init(void)
 		goto out_class;
 	}
 
+	amdgpu_metrics_debugfs_root = debugfs_create_dir(MODULE_NAME, NULL);
+	debugfs_create_file("budget", 0400, amdgpu_metrics_debugfs_root, NULL,
+			    &amdgpu_metrics_budget_fops);
+
 	err = amdgpu_metrics_register_path(gpu_metrics_path);
 	if (err) {
 		pr_err("Failed to register gpu_metrics path: %s\n", gpu_metrics_path);
@@ -665,6 +3592,7 @@ static int __init amdgpu_metrics_init(void)
 	return 0;
 
 out_device:
+	debugfs_remove_recursive(amdgpu_metrics_debugfs_root);
 	device_destroy(amdgpu_metrics_class, MKDEV(0, 0));
 out_class:
 	class_destroy(amdgpu_metrics_class);
@@ -672,15 +3600,28 @@ out:
 	return err;
 }
 
-static void __exit amdgpu_metrics_exit(void) {
-	if (!PTR_ERR_OR_ZERO(amdgpu_metrics_device))
+/* Also called by amdgpu_metrics_kunit.c, before its static stub goes away. */
+static void amdgpu_metrics_cleanup(void)
+{
+	debugfs_remove_recursive(amdgpu_metrics_debugfs_root);
+	amdgpu_metrics_debugfs_root = NULL;
+	if (!IS_ERR_OR_NULL(amdgpu_metrics_device))
 		device_destroy(amdgpu_metrics_class, MKDEV(0, 0));
-	if (!PTR_ERR_OR_ZERO(amdgpu_metrics_class))
+	amdgpu_metrics_device = NULL;
+	if (!IS_ERR_OR_NULL(amdgpu_metrics_class))
 		class_destroy(amdgpu_metrics_class);
+	amdgpu_metrics_class = NULL;
+}
+
+static void __exit amdgpu_metrics_exit(void) {
+	amdgpu_metrics_cleanup();
 }
 
+/* amdgpu_metrics_kunit.c registers devices on its own. */
+#ifndef AMDGPU_METRICS_KUNIT
 module_init(amdgpu_metrics_init);
 module_exit(amdgpu_metrics_exit);
+#endif
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Rongrong <i@rong.moe>");
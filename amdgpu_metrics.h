@@ -28,17 +28,21 @@
 
 #include <linux/compiler.h>
 #include <linux/errname.h>
+#include <linux/jiffies.h>
 #include <linux/limits.h>
 #include <linux/kernel.h>
+#include <linux/rwsem.h>
 
 #else /* !__KERNEL__ */
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 #define u8 uint8_t
 #define u16 uint16_t
@@ -65,6 +69,11 @@
 #endif
 
 #define ARRAY_SIZE(x)	(sizeof(x) / sizeof((x)[0]))
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+
+#ifndef min
+# define min(x, y)	((x) < (y) ? (x) : (y))
+#endif
 
 #define printk(fmt, ...)	fprintf(stderr, fmt, ##__VA_ARGS__)
 #define pr_debug(fmt, ...)	printk("DEBUG:   " fmt, ##__VA_ARGS__)
@@ -91,6 +100,45 @@
 # define errname(err) strerror(-err)
 #endif
 
+#define READ_ONCE(x)		__atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define WRITE_ONCE(x, val)	__atomic_store_n(&(x), (val), __ATOMIC_RELAXED)
+
+/* A monotonic millisecond clock stands in for jiffies. */
+#define HZ 1000
+
+static inline unsigned long amdgpu_metrics_jiffies(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+#define jiffies			amdgpu_metrics_jiffies()
+#define time_before(a, b)	((long)((a) - (b)) < 0)
+
+struct rw_semaphore {
+	pthread_rwlock_t rwlock;
+};
+
+static inline void init_rwsem(struct rw_semaphore *sem)
+{
+	pthread_rwlockattr_t attr;
+
+	pthread_rwlockattr_init(&attr);
+#ifdef __USE_GNU
+	/* Like rw_semaphore, don't let a stream of readers starve a writer. */
+	pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+	pthread_rwlock_init(&sem->rwlock, &attr);
+	pthread_rwlockattr_destroy(&attr);
+}
+
+#define down_read(sem)	pthread_rwlock_rdlock(&(sem)->rwlock)
+#define up_read(sem)	pthread_rwlock_unlock(&(sem)->rwlock)
+#define down_write(sem)	pthread_rwlock_wrlock(&(sem)->rwlock)
+#define up_write(sem)	pthread_rwlock_unlock(&(sem)->rwlock)
+
 #endif /* __KERNEL__ */
 
 #include "vendor/kgd_pp_interface.h"
@@ -193,9 +241,10 @@ static const char *amdgpu_metrics_labels_freq[] = {
 	"CoreCLK 12", "CoreCLK 13", "CoreCLK 14", "CoreCLK 15",
 	"L3CLK 0", "L3CLK 1",
 	"VPECLK", "IPUCLK", "MPIPUCLK",
+	"CoreCLK Max", "GFXCLK Max",
 };
-#define NCHANNELS_FREQ (ARRAY_SIZE(amdgpu_metrics_labels_freq)) /* 43 */
-#define REPEAT_NCHANNELS_FREQ(x) REPEAT_32(x), REPEAT_8(x), x, x, x
+#define NCHANNELS_FREQ (ARRAY_SIZE(amdgpu_metrics_labels_freq)) /* 45 */
+#define REPEAT_NCHANNELS_FREQ(x) REPEAT_32(x), REPEAT_8(x), REPEAT_4(x), x
 
 #define DEF_CHANNELS_FREQ(_t)		\
 union {					\
@@ -211,10 +260,238 @@ union {					\
 		_t vpeclk;		\
 		_t ipuclk;		\
 		_t mpipuclk;		\
+		_t coreclk_max;		\
+		_t gfxclk_max;		\
 	};				\
 	_t data[NCHANNELS_FREQ];	\
 }
 
+static const char *amdgpu_metrics_labels_in[] = {
+	"GFX", "SoC", "Mem", "CPU",
+};
+#define NCHANNELS_IN (ARRAY_SIZE(amdgpu_metrics_labels_in)) /* 4 */
+#define REPEAT_NCHANNELS_IN(x) REPEAT_4(x)
+
+/* mV */
+#define DEF_CHANNELS_IN(_t)		\
+union {					\
+	struct {			\
+		_t gfx;			\
+		_t soc;			\
+		_t mem;			\
+		_t cpu;			\
+	};				\
+	_t data[NCHANNELS_IN];		\
+}
+
+static const char *amdgpu_metrics_labels_curr[] = {
+	"CPU", "SoC", "GFX",
+};
+#define NCHANNELS_CURR (ARRAY_SIZE(amdgpu_metrics_labels_curr)) /* 3 */
+#define REPEAT_NCHANNELS_CURR(x) x, x, x
+
+/* mA */
+#define DEF_CHANNELS_CURR(_t)		\
+union {					\
+	struct {			\
+		_t cpu;			\
+		_t soc;			\
+		_t gfx;			\
+	};				\
+	_t data[NCHANNELS_CURR];	\
+}
+
+static const char *amdgpu_metrics_labels_fan[] = {
+	"Fan",
+};
+#define NCHANNELS_FAN (ARRAY_SIZE(amdgpu_metrics_labels_fan)) /* 1 */
+#define REPEAT_NCHANNELS_FAN(x) x
+
+/* RPM */
+#define DEF_CHANNELS_FAN(_t)		\
+union {					\
+	struct {			\
+		_t fan;			\
+	};				\
+	_t data[NCHANNELS_FAN];		\
+}
+
+static const char *amdgpu_metrics_labels_throttle[] = {
+	"PROCHOT", "PPT", "Socket THM", "VR THM", "HBM THM",
+	"SPL", "FPPT", "SPPT", "Core THM", "GFX THM", "SoC THM",
+};
+#define NCHANNELS_THROTTLE (ARRAY_SIZE(amdgpu_metrics_labels_throttle)) /* 11 */
+
+/* Accumulated throttler residencies */
+#define DEF_CHANNELS_THROTTLE(_t)	\
+union {					\
+	struct {			\
+		_t prochot;		\
+		_t ppt;			\
+		_t socket_thm;		\
+		_t vr_thm;		\
+		_t hbm_thm;		\
+		_t spl;			\
+		_t fppt;		\
+		_t sppt;		\
+		_t thm_core;		\
+		_t thm_gfx;		\
+		_t thm_soc;		\
+	};				\
+	_t data[NCHANNELS_THROTTLE];	\
+}
+
+#define NVCN 4
+#define NIPU 8
+
+static const char *amdgpu_metrics_labels_activity[] = {
+	"GFX", "UMC", "MM",
+	"VCN 0", "VCN 1", "VCN 2", "VCN 3",
+	"IPU 0", "IPU 1", "IPU 2", "IPU 3",
+	"IPU 4", "IPU 5", "IPU 6", "IPU 7",
+	"Core 0", "Core 1", "Core 2", "Core 3",
+	"Core 4", "Core 5", "Core 6", "Core 7",
+	"Core 8", "Core 9", "Core 10", "Core 11",
+	"Core 12", "Core 13", "Core 14", "Core 15",
+};
+#define NCHANNELS_ACTIVITY (ARRAY_SIZE(amdgpu_metrics_labels_activity)) /* 31 */
+
+/* Busy percentages, in activity_unit */
+#define DEF_CHANNELS_ACTIVITY(_t)	\
+union {					\
+	struct {			\
+		_t gfx;			\
+		_t umc;			\
+		_t mm;			\
+		_t vcn[NVCN];		\
+		_t ipu[NIPU];		\
+		_t core[NCORES];	\
+	};				\
+	_t data[NCHANNELS_ACTIVITY];	\
+}
+
+static const char *amdgpu_metrics_labels_bandwidth[] = {
+	"DRAM Reads", "DRAM Writes", "IPU Reads", "IPU Writes",
+};
+#define NCHANNELS_BANDWIDTH (ARRAY_SIZE(amdgpu_metrics_labels_bandwidth)) /* 4 */
+
+/* MB/s */
+#define DEF_CHANNELS_BANDWIDTH(_t)	\
+union {					\
+	struct {			\
+		_t dram_reads;		\
+		_t dram_writes;		\
+		_t ipu_reads;		\
+		_t ipu_writes;		\
+	};				\
+	_t data[NCHANNELS_BANDWIDTH];	\
+}
+
+#define NXCP 8
+#define NXCC 8
+
+#define XCC_LABELS(_xcp)					\
+	"XCP " #_xcp " XCC 0", "XCP " #_xcp " XCC 1",		\
+	"XCP " #_xcp " XCC 2", "XCP " #_xcp " XCC 3",		\
+	"XCP " #_xcp " XCC 4", "XCP " #_xcp " XCC 5",		\
+	"XCP " #_xcp " XCC 6", "XCP " #_xcp " XCC 7"
+
+static const char *amdgpu_metrics_labels_busy_acc[] = {
+	"GFX", "UMC",
+	XCC_LABELS(0), XCC_LABELS(1), XCC_LABELS(2), XCC_LABELS(3),
+	XCC_LABELS(4), XCC_LABELS(5), XCC_LABELS(6), XCC_LABELS(7),
+};
+#define NCHANNELS_BUSY_ACC (ARRAY_SIZE(amdgpu_metrics_labels_busy_acc)) /* 66 */
+
+/* Accumulated busy percentages, one unit per % and per accumulation cycle */
+#define DEF_CHANNELS_BUSY_ACC(_t)	\
+union {					\
+	struct {			\
+		_t gfx;			\
+		_t umc;			\
+		_t xcc[NXCP][NXCC];	\
+	};				\
+	_t data[NCHANNELS_BUSY_ACC];	\
+}
+
+#define NJPEG 40
+
+static const char *amdgpu_metrics_labels_xcc[] = {
+	"XCC 0", "XCC 1", "XCC 2", "XCC 3",
+	"XCC 4", "XCC 5", "XCC 6", "XCC 7",
+};
+
+static const char *amdgpu_metrics_labels_vcn[] = {
+	"VCN 0", "VCN 1", "VCN 2", "VCN 3",
+};
+
+static const char *amdgpu_metrics_labels_jpeg[] = {
+	"JPEG 0", "JPEG 1", "JPEG 2", "JPEG 3", "JPEG 4", "JPEG 5", "JPEG 6", "JPEG 7",
+	"JPEG 8", "JPEG 9", "JPEG 10", "JPEG 11", "JPEG 12", "JPEG 13", "JPEG 14", "JPEG 15",
+	"JPEG 16", "JPEG 17", "JPEG 18", "JPEG 19", "JPEG 20", "JPEG 21", "JPEG 22", "JPEG 23",
+	"JPEG 24", "JPEG 25", "JPEG 26", "JPEG 27", "JPEG 28", "JPEG 29", "JPEG 30", "JPEG 31",
+	"JPEG 32", "JPEG 33", "JPEG 34", "JPEG 35", "JPEG 36", "JPEG 37", "JPEG 38", "JPEG 39",
+};
+
+#define NXGMI 8
+
+static const char *amdgpu_metrics_labels_link[] = {
+	"PCIe",
+	"XGMI 0", "XGMI 1", "XGMI 2", "XGMI 3",
+	"XGMI 4", "XGMI 5", "XGMI 6", "XGMI 7",
+};
+#define NCHANNELS_LINK (ARRAY_SIZE(amdgpu_metrics_labels_link)) /* 9 */
+#define LINK_PCIE 0
+
+#define DEF_CHANNELS_LINK(_t)		\
+union {					\
+	struct {			\
+		_t pcie;		\
+		_t xgmi[NXGMI];		\
+	};				\
+	_t data[NCHANNELS_LINK];	\
+}
+
+static const char *amdgpu_metrics_labels_pcie_error[] = {
+	"L0 to Recovery", "Replay", "Replay Rollover",
+	"NAK Sent", "NAK Received", "Other End Recovery",
+};
+#define NCHANNELS_PCIE_ERROR (ARRAY_SIZE(amdgpu_metrics_labels_pcie_error)) /* 6 */
+
+/* Accumulated PCIe link error counters */
+#define DEF_CHANNELS_PCIE_ERROR(_t)	\
+union {					\
+	struct {			\
+		_t l0_to_recov;		\
+		_t replay;		\
+		_t replay_rover;	\
+		_t nak_sent;		\
+		_t nak_rcvd;		\
+		_t other_end_recov;	\
+	};				\
+	_t data[NCHANNELS_PCIE_ERROR];	\
+}
+
+/* ASIC-independent throttlers in indep_throttle_status, see SMU_THROTTLER_*_BIT in amdgpu_smu.h */
+static const char *amdgpu_metrics_labels_throttler[] = {
+	"PPT0", "PPT1", "PPT2", "PPT3", "SPL", "FPPT", "SPPT", "SPPT APU",
+	"TDC GFX", "TDC SoC", "TDC Mem", "TDC VDD", "TDC CVIP", "EDC CPU", "EDC GFX", "APCC",
+	"GPU THM", "Core THM", "Mem THM", "Edge THM", "Hotspot THM", "SoC THM",
+	"VRGFX THM", "VRSoC THM", "VRMem0 THM", "VRMem1 THM", "Liquid0 THM", "Liquid1 THM",
+	"VRHOT0", "VRHOT1", "PROCHOT CPU", "PROCHOT GFX",
+	"PPM", "FIT",
+};
+#define NCHANNELS_THROTTLER (ARRAY_SIZE(amdgpu_metrics_labels_throttler)) /* 34 */
+
+static const uint8_t amdgpu_metrics_throttler_bits[NCHANNELS_THROTTLER] = {
+	0, 1, 2, 3, 4, 5, 6, 7,
+	16, 17, 18, 19, 20, 21, 22, 23,
+	32, 33, 34, 35, 36, 37,
+	38, 39, 40, 41, 42, 43,
+	44, 45, 46, 47,
+	56, 57,
+};
+
 enum channel_data_type {
 	channel_null,
 	channel_u8,
@@ -258,25 +535,106 @@ typedef struct {
 
 #define is_channel_valid(e) (channel_null < (e).type && (e).type < channel_invalid)
 
+/*
+ * Channels of xcp_stats[0]. Those of xcp_stats[i] are i * xcp_stride bytes
+ * after, see amdgpu_metrics_get_xcp_val().
+ */
+struct amdgpu_metrics_xcp_def {
+	channel_t gfx_busy[NXCC];		/* % */
+	channel_t vcn_busy[NVCN];		/* % */
+	channel_t jpeg_busy[NJPEG];		/* % */
+	/* Accumulated clock counters while GFX runs below the host limit */
+	channel_t below_host_limit[NXCC];	/* Total */
+	channel_t below_host_limit_ppt[NXCC];
+	channel_t below_host_limit_thm[NXCC];
+	channel_t low_utilization[NXCC];
+};
+
 struct amdgpu_metrics_def {
 	uint16_t metrics_size;
 	DEF_CHANNELS_TEMP(channel_t) temp;
 	DEF_CHANNELS_POWER(channel_t) power;
 	DEF_CHANNELS_FREQ(channel_t) freq;
+	/* Optional groups, zero (channel_null) if not defined by a revision */
+	DEF_CHANNELS_IN(channel_t) in;
+	DEF_CHANNELS_CURR(channel_t) curr;
+	DEF_CHANNELS_FAN(channel_t) fan;
+	DEF_CHANNELS_ACTIVITY(channel_t) activity;
+	DEF_CHANNELS_BANDWIDTH(channel_t) bandwidth;
+	DEF_CHANNELS_BUSY_ACC(channel_t) busy_acc;
+	DEF_CHANNELS_THROTTLE(channel_t) throttle;
+	DEF_CHANNELS_PCIE_ERROR(channel_t) pcie_error;
+	/* Milli-percent per unit of activity channels, which differs between revisions */
+	uint16_t activity_unit;
+	/* Each link has a channel in each of them */
+	struct {
+		DEF_CHANNELS_LINK(channel_t) width;	/* Lanes */
+		DEF_CHANNELS_LINK(channel_t) speed;	/* 0.1 GT/s (PCIe) or Gbps (XGMI) */
+		DEF_CHANNELS_LINK(channel_t) bandwidth;	/* GB/s */
+		DEF_CHANNELS_LINK(channel_t) read_acc;	/* KB */
+		DEF_CHANNELS_LINK(channel_t) write_acc;	/* KB */
+		DEF_CHANNELS_LINK(channel_t) status;	/* Active or not */
+	} link;
+	struct amdgpu_metrics_xcp_def xcp;
+	uint16_t xcp_stride;
+	/* Number of active partitions, i.e., of valid xcp_stats[] */
+	channel_t num_partition;
+	/* Accumulation cycle counter, the time base of accumulated counters */
+	channel_t acc_counter;
+	/* PMFW timestamp in 10ns */
+	channel_t fw_timestamp;
+	/* Timestamp of the snapshot in ns, defined by all revisions */
+	channel_t system_clock_counter;
+	/* Bitmask of active throttlers, see amdgpu_metrics_throttler_bits */
+	channel_t indep_throttle_status;
+	/* Limits of the socket power, in mW */
+	channel_t power_cap;		/* Current STAPM limit */
+	channel_t power_cap_max;	/* Maximum STAPM limit */
 };
 
 typedef struct {
 	bool valid : 1;
 	bool ext : 1;
-	uint8_t idx : 6;
+	uint8_t idx; /* Of the label, a bit-field would overflow with busy_acc */
 } remap_t;
 
+/* The index of any channel must fit in remap_t.idx. */
+#define REMAP_IDX_FITS(_nchannels) \
+	_Static_assert((_nchannels) <= U8_MAX + 1, #_nchannels " overflows remap_t.idx")
+REMAP_IDX_FITS(NCHANNELS_TEMP);
+REMAP_IDX_FITS(NCHANNELS_POWER);
+REMAP_IDX_FITS(NCHANNELS_FREQ);
+REMAP_IDX_FITS(NCHANNELS_IN);
+REMAP_IDX_FITS(NCHANNELS_CURR);
+REMAP_IDX_FITS(NCHANNELS_FAN);
+REMAP_IDX_FITS(NCHANNELS_THROTTLE);
+REMAP_IDX_FITS(NCHANNELS_ACTIVITY);
+REMAP_IDX_FITS(NCHANNELS_BANDWIDTH);
+REMAP_IDX_FITS(NCHANNELS_BUSY_ACC);
+REMAP_IDX_FITS(NCHANNELS_LINK);
+REMAP_IDX_FITS(NCHANNELS_PCIE_ERROR);
+REMAP_IDX_FITS(NCHANNELS_THROTTLER);
+REMAP_IDX_FITS(NCORES);
+
 struct amdgpu_metrics_labels_remap {
 	DEF_CHANNELS_TEMP(remap_t) temp;
 	DEF_CHANNELS_POWER(remap_t) power;
 	DEF_CHANNELS_FREQ(remap_t) freq;
+	DEF_CHANNELS_IN(remap_t) in;
+	DEF_CHANNELS_CURR(remap_t) curr;
+	DEF_CHANNELS_FAN(remap_t) fan;
+	DEF_CHANNELS_ACTIVITY(remap_t) activity;
+	DEF_CHANNELS_BANDWIDTH(remap_t) bandwidth;
+	DEF_CHANNELS_BUSY_ACC(remap_t) busy_acc;
+	DEF_CHANNELS_THROTTLE(remap_t) throttle;
+	DEF_CHANNELS_PCIE_ERROR(remap_t) pcie_error;
 };
 
+/* Index of a named channel in the flat data[] array of its channel group. */
+#define REMAP_IDX(_channel_group, _channel)						\
+	((offsetof(struct amdgpu_metrics_labels_remap, _channel_group._channel) -	\
+	  offsetof(struct amdgpu_metrics_labels_remap, _channel_group)) / sizeof(remap_t))
+
 #define _mbr_to_data_type_enum(_t, _mbr) \
 	to_data_type_enum(((_t *)0)->_mbr)
 
@@ -321,14 +679,41 @@ struct amdgpu_metrics_labels_remap {
 	DEF_CHANNEL_ARR8(_v, _channel, _mbr, 0 + (_off)),	\
 	DEF_CHANNEL_ARR8(_v, _channel, _mbr, 8 + (_off))
 
-#define DEF_CHANNELS(_v, _temp, _power, _freq)				\
+#define DEF_CHANNEL_ARR32(_v, _channel, _mbr, _off)		\
+	DEF_CHANNEL_ARR16(_v, _channel, _mbr, 0 + (_off)),	\
+	DEF_CHANNEL_ARR16(_v, _channel, _mbr, 16 + (_off))
+
+#define DEF_CHANNEL_XCC(_v, _xcp, _xcc) \
+	DEF_CHANNEL(_v, xcc[_xcp][_xcc], xcp_stats[_xcp].gfx_busy_acc[_xcc])
+
+#define DEF_CHANNEL_XCC8(_v, _xcp)						\
+	DEF_CHANNEL_XCC(_v, _xcp, 0), DEF_CHANNEL_XCC(_v, _xcp, 1),		\
+	DEF_CHANNEL_XCC(_v, _xcp, 2), DEF_CHANNEL_XCC(_v, _xcp, 3),		\
+	DEF_CHANNEL_XCC(_v, _xcp, 4), DEF_CHANNEL_XCC(_v, _xcp, 5),		\
+	DEF_CHANNEL_XCC(_v, _xcp, 6), DEF_CHANNEL_XCC(_v, _xcp, 7)
+
+/* Optional groups and channels follow the mandatory ones. */
+#define DEF_CHANNELS(_v, _temp, _power, _freq, ...)			\
 	{								\
 		.metrics_size = sizeof(struct gpu_metrics_##_v),	\
 		.temp = { _temp(_v), },					\
 		.power = { _power(_v), },				\
 		.freq = { _freq(_v), },					\
+		DEF_CHANNEL(_v, system_clock_counter, system_clock_counter),	\
+		__VA_ARGS__						\
 	}
 
+#define DEF_GROUP(_v, _channel_group, _def) \
+	._channel_group = { _def(_v), }
+
+#define DEF_GROUP_ACTIVITY(_v, _def, _unit)	\
+	DEF_GROUP(_v, activity, _def),		\
+	.activity_unit = (_unit)
+
+/* Activities are in % on dGPUs and v3 APUs, but in centi-% on v2 APUs. */
+#define ACTIVITY_UNIT_PERCENT 1000
+#define ACTIVITY_UNIT_CENTI_PERCENT 10
+
 #define DEF_CHANNEL_TEMP_V1_COMMON1(_v)			\
 	DEF_CHANNEL(_v, hotspot, temperature_hotspot),	\
 	DEF_CHANNEL(_v, mem, temperature_mem),		\
@@ -355,19 +740,55 @@ struct amdgpu_metrics_labels_remap {
 	DEF_CHANNEL_FB(_v, dclk[0], current_dclk0, average_vclk1_frequency),		\
 	DEF_CHANNEL_FB(_v, dclk[1], current_dclk1, average_dclk1_frequency)
 
-#define DEF_CHANNELS_V1_0(_v)				\
-	DEF_CHANNELS(_v, DEF_CHANNEL_TEMP_V1_0,		\
-			 DEF_CHANNEL_POWER_V1_0,	\
-			 DEF_CHANNEL_FREQ_V1_0)
+#define DEF_CHANNEL_LINK_V1_0(_v)			\
+	DEF_CHANNEL(_v, width.pcie, pcie_link_width),	\
+	DEF_CHANNEL(_v, speed.pcie, pcie_link_speed)
+
+#define DEF_CHANNEL_ACTIVITY_V1_0(_v)			\
+	DEF_CHANNEL(_v, gfx, average_gfx_activity),	\
+	DEF_CHANNEL(_v, umc, average_umc_activity),	\
+	DEF_CHANNEL(_v, mm, average_mm_activity)
+
+#define DEF_CHANNEL_FAN_V1_0(_v) \
+	DEF_CHANNEL(_v, fan, current_fan_speed)
+
+#define DEF_CHANNELS_V1_0(_v)							\
+	DEF_CHANNELS(_v, DEF_CHANNEL_TEMP_V1_0,					\
+			 DEF_CHANNEL_POWER_V1_0,				\
+			 DEF_CHANNEL_FREQ_V1_0,					\
+			 DEF_GROUP(_v, fan, DEF_CHANNEL_FAN_V1_0),		\
+			 DEF_GROUP_ACTIVITY(_v, DEF_CHANNEL_ACTIVITY_V1_0,	\
+					    ACTIVITY_UNIT_PERCENT),		\
+			 DEF_GROUP(_v, link, DEF_CHANNEL_LINK_V1_0))
 
 #define DEF_CHANNEL_TEMP_V1_1(_v)				\
 	DEF_CHANNEL_TEMP_V1_0(_v),				\
 	DEF_CHANNEL_ARR4(_v, hbm, temperature_hbm, 0)
 
-#define DEF_CHANNELS_V1_1(_v)				\
-	DEF_CHANNELS(_v, DEF_CHANNEL_TEMP_V1_1,		\
-			 DEF_CHANNEL_POWER_V1_0,	\
-			 DEF_CHANNEL_FREQ_V1_0)
+#define DEF_CHANNELS_V1_1(_v)							\
+	DEF_CHANNELS(_v, DEF_CHANNEL_TEMP_V1_1,					\
+			 DEF_CHANNEL_POWER_V1_0,				\
+			 DEF_CHANNEL_FREQ_V1_0,					\
+			 DEF_GROUP(_v, fan, DEF_CHANNEL_FAN_V1_0),		\
+			 DEF_GROUP_ACTIVITY(_v, DEF_CHANNEL_ACTIVITY_V1_0,	\
+					    ACTIVITY_UNIT_PERCENT),		\
+			 DEF_GROUP(_v, link, DEF_CHANNEL_LINK_V1_0))
+
+#define DEF_CHANNEL_IN_V1_3(_v)			\
+	DEF_CHANNEL(_v, gfx, voltage_gfx),	\
+	DEF_CHANNEL(_v, soc, voltage_soc),	\
+	DEF_CHANNEL(_v, mem, voltage_mem)
+
+#define DEF_CHANNELS_V1_3(_v)							\
+	DEF_CHANNELS(_v, DEF_CHANNEL_TEMP_V1_1,					\
+			 DEF_CHANNEL_POWER_V1_0,				\
+			 DEF_CHANNEL_FREQ_V1_0,					\
+			 DEF_GROUP(_v, in, DEF_CHANNEL_IN_V1_3),		\
+			 DEF_GROUP(_v, fan, DEF_CHANNEL_FAN_V1_0),		\
+			 DEF_GROUP_ACTIVITY(_v, DEF_CHANNEL_ACTIVITY_V1_0,	\
+					    ACTIVITY_UNIT_PERCENT),		\
+			 DEF_GROUP(_v, link, DEF_CHANNEL_LINK_V1_0),		\
+			 DEF_CHANNEL(_v, indep_throttle_status, indep_throttle_status))
 
 #define DEF_CHANNEL_POWER_V1_4(_v) \
 	DEF_CHANNEL(_v, socket, curr_socket_power)
@@ -379,10 +800,126 @@ struct amdgpu_metrics_labels_remap {
 	DEF_CHANNEL_ARR4(_v, vclk, current_vclk0, 0),		\
 	DEF_CHANNEL_ARR4(_v, dclk, current_dclk0, 0)
 
-#define DEF_CHANNELS_V1_4(_v)				\
-	DEF_CHANNELS(_v, DEF_CHANNEL_TEMP_V1_COMMON1,	\
-			 DEF_CHANNEL_POWER_V1_4,	\
-			 DEF_CHANNEL_FREQ_V1_4)
+#define DEF_CHANNEL_ACTIVITY_V1_4(_v)			\
+	DEF_CHANNEL(_v, gfx, average_gfx_activity),	\
+	DEF_CHANNEL(_v, umc, average_umc_activity),	\
+	DEF_CHANNEL_ARR4(_v, vcn, vcn_activity, 0)
+
+#define DEF_CHANNEL_XGMI(_v, _n)					\
+	DEF_CHANNEL(_v, width.xgmi[_n], xgmi_link_width),		\
+	DEF_CHANNEL(_v, speed.xgmi[_n], xgmi_link_speed),		\
+	DEF_CHANNEL(_v, read_acc.xgmi[_n], xgmi_read_data_acc[_n]),	\
+	DEF_CHANNEL(_v, write_acc.xgmi[_n], xgmi_write_data_acc[_n])
+
+#define DEF_CHANNEL_LINK_V1_4(_v)					\
+	DEF_CHANNEL_LINK_V1_0(_v),					\
+	DEF_CHANNEL(_v, bandwidth.pcie, pcie_bandwidth_inst),		\
+	DEF_CHANNEL_XGMI(_v, 0), DEF_CHANNEL_XGMI(_v, 1),		\
+	DEF_CHANNEL_XGMI(_v, 2), DEF_CHANNEL_XGMI(_v, 3),		\
+	DEF_CHANNEL_XGMI(_v, 4), DEF_CHANNEL_XGMI(_v, 5),		\
+	DEF_CHANNEL_XGMI(_v, 6), DEF_CHANNEL_XGMI(_v, 7)
+
+#define DEF_CHANNEL_LINK_V1_7(_v)					\
+	DEF_CHANNEL_LINK_V1_4(_v),					\
+	DEF_CHANNEL_ARR8(_v, status.xgmi, xgmi_link_status, 0)
+
+#define DEF_CHANNEL_PCIE_ERROR_V1_4(_v)				\
+	DEF_CHANNEL(_v, l0_to_recov, pcie_l0_to_recov_count_acc),	\
+	DEF_CHANNEL(_v, replay, pcie_replay_count_acc),			\
+	DEF_CHANNEL(_v, replay_rover, pcie_replay_rover_count_acc)
+
+#define DEF_CHANNEL_PCIE_ERROR_V1_5(_v)				\
+	DEF_CHANNEL_PCIE_ERROR_V1_4(_v),			\
+	DEF_CHANNEL(_v, nak_sent, pcie_nak_sent_count_acc),	\
+	DEF_CHANNEL(_v, nak_rcvd, pcie_nak_rcvd_count_acc)
+
+#define DEF_CHANNEL_PCIE_ERROR_V1_6(_v)						\
+	DEF_CHANNEL_PCIE_ERROR_V1_5(_v),					\
+	DEF_CHANNEL(_v, other_end_recov, pcie_lc_perf_other_end_recovery)
+
+#define _DEF_CHANNELS_V1_4(_v, _pcie_error)					\
+	DEF_CHANNELS(_v, DEF_CHANNEL_TEMP_V1_COMMON1,				\
+			 DEF_CHANNEL_POWER_V1_4,				\
+			 DEF_CHANNEL_FREQ_V1_4,					\
+			 DEF_GROUP_ACTIVITY(_v, DEF_CHANNEL_ACTIVITY_V1_4,	\
+					    ACTIVITY_UNIT_PERCENT),		\
+			 DEF_GROUP(_v, link, DEF_CHANNEL_LINK_V1_4),		\
+			 DEF_GROUP(_v, pcie_error, _pcie_error),		\
+			 DEF_CHANNEL(_v, fw_timestamp, firmware_timestamp))
+
+#define DEF_CHANNELS_V1_4(_v) \
+	_DEF_CHANNELS_V1_4(_v, DEF_CHANNEL_PCIE_ERROR_V1_4)
+
+/* v1.5 adds pcie_nak_*_count_acc. */
+#define DEF_CHANNELS_V1_5(_v) \
+	_DEF_CHANNELS_V1_4(_v, DEF_CHANNEL_PCIE_ERROR_V1_5)
+
+#define DEF_CHANNEL_THROTTLE_V1_6(_v)				\
+	DEF_CHANNEL(_v, prochot, prochot_residency_acc),	\
+	DEF_CHANNEL(_v, ppt, ppt_residency_acc),		\
+	DEF_CHANNEL(_v, socket_thm, socket_thm_residency_acc),	\
+	DEF_CHANNEL(_v, vr_thm, vr_thm_residency_acc),		\
+	DEF_CHANNEL(_v, hbm_thm, hbm_thm_residency_acc)
+
+#define DEF_CHANNEL_ACTIVITY_V1_6(_v)			\
+	DEF_CHANNEL(_v, gfx, average_gfx_activity),	\
+	DEF_CHANNEL(_v, umc, average_umc_activity)
+
+/* Only accumulated over accumulation_counter since v1.6 */
+#define DEF_CHANNEL_BUSY_ACC_V1_6(_v)				\
+	DEF_CHANNEL(_v, gfx, gfx_activity_acc),			\
+	DEF_CHANNEL(_v, umc, mem_activity_acc),			\
+	DEF_CHANNEL_XCC8(_v, 0), DEF_CHANNEL_XCC8(_v, 1),	\
+	DEF_CHANNEL_XCC8(_v, 2), DEF_CHANNEL_XCC8(_v, 3),	\
+	DEF_CHANNEL_XCC8(_v, 4), DEF_CHANNEL_XCC8(_v, 5),	\
+	DEF_CHANNEL_XCC8(_v, 6), DEF_CHANNEL_XCC8(_v, 7)
+
+#define DEF_CHANNEL_XCP_V1_6(_v)						\
+	DEF_CHANNEL_ARR8(_v, gfx_busy, xcp_stats[0].gfx_busy_inst, 0),		\
+	DEF_CHANNEL_ARR4(_v, vcn_busy, xcp_stats[0].vcn_busy, 0),		\
+	DEF_CHANNEL_ARR32(_v, jpeg_busy, xcp_stats[0].jpeg_busy, 0)
+
+#define DEF_CHANNEL_XCP_V1_7(_v)							\
+	DEF_CHANNEL_XCP_V1_6(_v),							\
+	DEF_CHANNEL_ARR8(_v, below_host_limit, xcp_stats[0].gfx_below_host_limit_acc, 0)
+
+#define DEF_CHANNEL_XCP_V1_8(_v)								\
+	DEF_CHANNEL_XCP_V1_6(_v),								\
+	DEF_CHANNEL_ARR8(_v, jpeg_busy, xcp_stats[0].jpeg_busy, 32),				\
+	DEF_CHANNEL_ARR8(_v, below_host_limit, xcp_stats[0].gfx_below_host_limit_total_acc, 0),	\
+	DEF_CHANNEL_ARR8(_v, below_host_limit_ppt, xcp_stats[0].gfx_below_host_limit_ppt_acc, 0),	\
+	DEF_CHANNEL_ARR8(_v, below_host_limit_thm, xcp_stats[0].gfx_below_host_limit_thm_acc, 0),	\
+	DEF_CHANNEL_ARR8(_v, low_utilization, xcp_stats[0].gfx_low_utilization_acc, 0)
+
+#define DEF_GROUP_XCP(_v, _def)						\
+	DEF_GROUP(_v, xcp, _def),					\
+	.xcp_stride = sizeof(((struct gpu_metrics_##_v *)0)->xcp_stats[0]),	\
+	DEF_CHANNEL(_v, num_partition, num_partition)
+
+#define _DEF_CHANNELS_V1_6(_v, _link, _xcp)					\
+	DEF_CHANNELS(_v, DEF_CHANNEL_TEMP_V1_COMMON1,				\
+			 DEF_CHANNEL_POWER_V1_4,				\
+			 DEF_CHANNEL_FREQ_V1_4,					\
+			 DEF_GROUP_ACTIVITY(_v, DEF_CHANNEL_ACTIVITY_V1_6,	\
+					    ACTIVITY_UNIT_PERCENT),		\
+			 DEF_GROUP(_v, busy_acc, DEF_CHANNEL_BUSY_ACC_V1_6),	\
+			 DEF_GROUP(_v, throttle, DEF_CHANNEL_THROTTLE_V1_6),	\
+			 DEF_GROUP(_v, link, _link),				\
+			 DEF_GROUP_XCP(_v, _xcp),				\
+			 DEF_GROUP(_v, pcie_error, DEF_CHANNEL_PCIE_ERROR_V1_6),	\
+			 DEF_CHANNEL(_v, acc_counter, accumulation_counter),	\
+			 DEF_CHANNEL(_v, fw_timestamp, firmware_timestamp))
+
+#define DEF_CHANNELS_V1_6(_v) \
+	_DEF_CHANNELS_V1_6(_v, DEF_CHANNEL_LINK_V1_4, DEF_CHANNEL_XCP_V1_6)
+
+/* v1.7 adds xgmi_link_status and gfx_below_host_limit_acc. */
+#define DEF_CHANNELS_V1_7(_v) \
+	_DEF_CHANNELS_V1_6(_v, DEF_CHANNEL_LINK_V1_7, DEF_CHANNEL_XCP_V1_7)
+
+/* v1.8 splits gfx_below_host_limit_acc and has more JPEG engines. */
+#define DEF_CHANNELS_V1_8(_v) \
+	_DEF_CHANNELS_V1_6(_v, DEF_CHANNEL_LINK_V1_7, DEF_CHANNEL_XCP_V1_8)
 
 #define DEF_CHANNEL_TEMP_V2(_v)					\
 	DEF_CHANNEL(_v, gfx, temperature_gfx),			\
@@ -407,10 +944,39 @@ struct amdgpu_metrics_labels_remap {
 	DEF_CHANNEL_ARR8(_v, coreclk, current_coreclk, 0),				\
 	DEF_CHANNEL_ARR2(_v, l3clk, current_l3clk, 0)
 
-#define DEF_CHANNELS_V2_0(_v)			\
-	DEF_CHANNELS(_v, DEF_CHANNEL_TEMP_V2,	\
-			 DEF_CHANNEL_POWER_V2,	\
-			 DEF_CHANNEL_FREQ_V2)
+#define DEF_CHANNEL_ACTIVITY_V2(_v)			\
+	DEF_CHANNEL(_v, gfx, average_gfx_activity),	\
+	DEF_CHANNEL(_v, mm, average_mm_activity)
+
+#define DEF_CHANNELS_V2_0(_v)						\
+	DEF_CHANNELS(_v, DEF_CHANNEL_TEMP_V2,				\
+			 DEF_CHANNEL_POWER_V2,				\
+			 DEF_CHANNEL_FREQ_V2,				\
+			 DEF_GROUP_ACTIVITY(_v, DEF_CHANNEL_ACTIVITY_V2,	\
+					    ACTIVITY_UNIT_CENTI_PERCENT))
+
+#define DEF_CHANNELS_V2_2(_v, ...)					\
+	DEF_CHANNELS(_v, DEF_CHANNEL_TEMP_V2,				\
+			 DEF_CHANNEL_POWER_V2,				\
+			 DEF_CHANNEL_FREQ_V2,				\
+			 DEF_GROUP_ACTIVITY(_v, DEF_CHANNEL_ACTIVITY_V2,	\
+					    ACTIVITY_UNIT_CENTI_PERCENT),	\
+			 DEF_CHANNEL(_v, indep_throttle_status, indep_throttle_status), \
+			 ##__VA_ARGS__)
+
+#define DEF_CHANNEL_IN_V2_4(_v)				\
+	DEF_CHANNEL(_v, cpu, average_cpu_voltage),	\
+	DEF_CHANNEL(_v, soc, average_soc_voltage),	\
+	DEF_CHANNEL(_v, gfx, average_gfx_voltage)
+
+#define DEF_CHANNEL_CURR_V2_4(_v)			\
+	DEF_CHANNEL(_v, cpu, average_cpu_current),	\
+	DEF_CHANNEL(_v, soc, average_soc_current),	\
+	DEF_CHANNEL(_v, gfx, average_gfx_current)
+
+#define DEF_CHANNELS_V2_4(_v)						\
+	DEF_CHANNELS_V2_2(_v, DEF_GROUP(_v, in, DEF_CHANNEL_IN_V2_4),	\
+			      DEF_GROUP(_v, curr, DEF_CHANNEL_CURR_V2_4))
 
 #define DEF_CHANNEL_TEMP_V3(_v)					\
 	DEF_CHANNEL(_v, gfx, temperature_gfx),			\
@@ -437,31 +1003,61 @@ struct amdgpu_metrics_labels_remap {
 	DEF_CHANNEL(_v, vclk[0], average_vclk_frequency),	\
 	DEF_CHANNEL(_v, uclk, average_uclk_frequency),		\
 	DEF_CHANNEL_ARR16(_v, coreclk, current_coreclk, 0),	\
-	DEF_CHANNEL(_v, mpipuclk, average_mpipu_frequency)
-
-#define DEF_CHANNELS_V3_0(_v)			\
-	DEF_CHANNELS(_v, DEF_CHANNEL_TEMP_V3,	\
-			 DEF_CHANNEL_POWER_V3,	\
-			 DEF_CHANNEL_FREQ_V3)
+	DEF_CHANNEL(_v, mpipuclk, average_mpipu_frequency),	\
+	DEF_CHANNEL(_v, coreclk_max, current_core_maxfreq),	\
+	DEF_CHANNEL(_v, gfxclk_max, current_gfx_maxfreq)
+
+/* The time base of these residencies is undocumented, so no rate is derived. */
+#define DEF_CHANNEL_THROTTLE_V3(_v)					\
+	DEF_CHANNEL(_v, prochot, throttle_residency_prochot),		\
+	DEF_CHANNEL(_v, spl, throttle_residency_spl),			\
+	DEF_CHANNEL(_v, fppt, throttle_residency_fppt),			\
+	DEF_CHANNEL(_v, sppt, throttle_residency_sppt),			\
+	DEF_CHANNEL(_v, thm_core, throttle_residency_thm_core),		\
+	DEF_CHANNEL(_v, thm_gfx, throttle_residency_thm_gfx),		\
+	DEF_CHANNEL(_v, thm_soc, throttle_residency_thm_soc)
+
+#define DEF_CHANNEL_ACTIVITY_V3(_v)					\
+	DEF_CHANNEL(_v, gfx, average_gfx_activity),			\
+	DEF_CHANNEL(_v, vcn[0], average_vcn_activity),			\
+	DEF_CHANNEL_ARR8(_v, ipu, average_ipu_activity, 0),		\
+	DEF_CHANNEL_ARR16(_v, core, average_core_c0_activity, 0)
+
+#define DEF_CHANNEL_BANDWIDTH_V3(_v)				\
+	DEF_CHANNEL(_v, dram_reads, average_dram_reads),	\
+	DEF_CHANNEL(_v, dram_writes, average_dram_writes),	\
+	DEF_CHANNEL(_v, ipu_reads, average_ipu_reads),		\
+	DEF_CHANNEL(_v, ipu_writes, average_ipu_writes)
+
+#define DEF_CHANNELS_V3_0(_v)							\
+	DEF_CHANNELS(_v, DEF_CHANNEL_TEMP_V3,					\
+			 DEF_CHANNEL_POWER_V3,					\
+			 DEF_CHANNEL_FREQ_V3,					\
+			 DEF_GROUP_ACTIVITY(_v, DEF_CHANNEL_ACTIVITY_V3,	\
+					    ACTIVITY_UNIT_PERCENT),		\
+			 DEF_GROUP(_v, bandwidth, DEF_CHANNEL_BANDWIDTH_V3),	\
+			 DEF_GROUP(_v, throttle, DEF_CHANNEL_THROTTLE_V3),	\
+			 DEF_CHANNEL(_v, power_cap, current_stapm_power_limit),	\
+			 DEF_CHANNEL(_v, power_cap_max, stapm_power_limit))
 
 static const struct amdgpu_metrics_def amdgpu_metric_def_table_v1[] = {
 	[0] = DEF_CHANNELS_V1_0(v1_0),
 	[1] = DEF_CHANNELS_V1_1(v1_1),
 	[2] = DEF_CHANNELS_V1_1(v1_2),
-	[3] = DEF_CHANNELS_V1_1(v1_3),
+	[3] = DEF_CHANNELS_V1_3(v1_3),
 	[4] = DEF_CHANNELS_V1_4(v1_4),
-	[5] = DEF_CHANNELS_V1_4(v1_5),
-	[6] = DEF_CHANNELS_V1_4(v1_6),
-	[7] = DEF_CHANNELS_V1_4(v1_7),
-	[8] = DEF_CHANNELS_V1_4(v1_8),
+	[5] = DEF_CHANNELS_V1_5(v1_5),
+	[6] = DEF_CHANNELS_V1_6(v1_6),
+	[7] = DEF_CHANNELS_V1_7(v1_7),
+	[8] = DEF_CHANNELS_V1_8(v1_8),
 };
 
 static const struct amdgpu_metrics_def amdgpu_metric_def_table_v2[] = {
 	[0] = DEF_CHANNELS_V2_0(v2_0),
 	[1] = DEF_CHANNELS_V2_0(v2_1),
-	[2] = DEF_CHANNELS_V2_0(v2_2),
-	[3] = DEF_CHANNELS_V2_0(v2_3),
-	[4] = DEF_CHANNELS_V2_0(v2_4),
+	[2] = DEF_CHANNELS_V2_2(v2_2),
+	[3] = DEF_CHANNELS_V2_2(v2_3),
+	[4] = DEF_CHANNELS_V2_4(v2_4),
 };
 
 static const struct amdgpu_metrics_def amdgpu_metric_def_table_v3[] = {
@@ -519,9 +1115,249 @@ struct amdgpu_metrics_private_common {
 	struct amdgpu_metrics_labels_remap remap;
 	bool has_per_core;
 
-	union gpu_metrics metrics;
+	/* Only channels->metrics_size bytes may be allocated, see amdgpu_metrics_get_val(). */
+	union gpu_metrics *metrics;
+};
+
+/*
+ * Readers refresh the snapshot on demand, at most once per UPDATE_INTERVAL_MS
+ * unless forced, and read it with metrics_lock held for reading.
+ */
+#define UPDATE_INTERVAL_MS 100
+#define UPDATE_INTERVAL_JIFFIES (UPDATE_INTERVAL_MS * HZ / 1000)
+
+struct amdgpu_metrics_refresh {
+	struct rw_semaphore metrics_lock;
+	unsigned long last_update_jiffies;
+
+	/* Protected by metrics_lock */
+	u64 generation;
+};
+
+struct amdgpu_metrics_refresh_ops {
+	/* Optional, the snapshot is recent enough */
+	void (*skipped)(void *data);
+	/*
+	 * Optional, false to serve the snapshot as is. Called without
+	 * metrics_lock with !@take, which must not consume anything, then with
+	 * it held for writing and @take once the refresh is known to be due.
+	 */
+	bool (*admit)(void *data, bool take);
+	/* Called with metrics_lock held for writing, returns 0 or an error code */
+	int (*update)(void *data, bool force);
+	/* Optional, called with metrics_lock held for writing after generation is bumped */
+	void (*updated)(void *data);
+};
+
+static inline void amdgpu_metrics_refresh_init(struct amdgpu_metrics_refresh *refresh)
+{
+	init_rwsem(&refresh->metrics_lock);
+	refresh->last_update_jiffies = 0;
+	refresh->generation = 0;
+}
+
+/*
+ * <0: error
+ * 0: no need to update
+ * >0: updated
+ *
+ * Readers finding the snapshot stale at once queue up on metrics_lock. Only the
+ * first of them refreshes it, the rest see last_update_jiffies moved under the
+ * lock and serve that snapshot instead of reading it over again.
+ *
+ * @force: ignore UPDATE_INTERVAL_MS, e.g., when sampling on an IIO trigger
+ */
+static int amdgpu_metrics_refresh(struct amdgpu_metrics_refresh *refresh,
+				  const struct amdgpu_metrics_refresh_ops *ops, void *data,
+				  bool force)
+{
+	unsigned long last = READ_ONCE(refresh->last_update_jiffies);
+	int err;
+
+	if (!force && time_before(jiffies, last + UPDATE_INTERVAL_JIFFIES))
+		goto skipped;
+
+	/*
+	 * Throttled readers go straight to the cached snapshot instead of
+	 * queueing up one by one on metrics_lock to be told so.
+	 */
+	if (ops->admit && !ops->admit(data, false))
+		return 0;
+
+	down_write(&refresh->metrics_lock);
+
+	if (!force && refresh->last_update_jiffies != last) {
+		up_write(&refresh->metrics_lock);
+		goto skipped;
+	}
+
+	/* Only the reader that actually refreshes spends the budget. */
+	if (ops->admit && !ops->admit(data, true)) {
+		up_write(&refresh->metrics_lock);
+		return 0;
+	}
+
+	err = ops->update(data, force);
+	if (!err) {
+		WRITE_ONCE(refresh->last_update_jiffies, jiffies);
+		refresh->generation++;
+		if (ops->updated)
+			ops->updated(data);
+	}
+
+	up_write(&refresh->metrics_lock);
+	return err ?: 1;
+
+skipped:
+	if (ops->skipped)
+		ops->skipped(data);
+	return 0;
+}
+
+/*
+ * Flight recorder format, as read from the per-device "history" file in debugfs.
+ *
+ * The header is followed by nr_records records, oldest first. Each record is
+ * followed by its payload, padded to 8 bytes. The first record is always a
+ * keyframe.
+ */
+#define AMDGPU_METRICS_HISTORY_MAGIC	0x48524d41 /* "AMRH" */
+#define AMDGPU_METRICS_HISTORY_VERSION	2
+
+#define AMDGPU_METRICS_HISTORY_FROZEN	(1 << 0)
+
+struct amdgpu_metrics_history_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t flags;
+	uint32_t nr_records;
+	uint32_t reserved;
+};
+
+enum amdgpu_metrics_history_kind {
+	history_keyframe, /* The payload is a full gpu_metrics table. */
+	history_delta, /* The payload is a series of runs against the previous record. */
+};
+
+struct amdgpu_metrics_history_record {
+	uint64_t timestamp_ns; /* CLOCK_MONOTONIC */
+	uint64_t seq; /* The generation of the snapshot */
+	uint16_t size; /* of the payload, excluding padding */
+	uint8_t kind;
+	uint8_t reserved[5];
+};
+
+/*
+ * A run of changed 32-bit words, followed by nwords words, each XORed with the
+ * same word in the previous snapshot. Most words (static fields, padding,
+ * slowly changing counters) don't change between two samples.
+ */
+struct amdgpu_metrics_history_run {
+	uint16_t word;
+	uint16_t nwords;
 };
 
+#define AMDGPU_METRICS_HISTORY_RECORD_SIZE(_payload_size) \
+	(sizeof(struct amdgpu_metrics_history_record) + (((_payload_size) + 7) & ~7))
+
+/* A trailing partial word is zero-padded. */
+static inline uint32_t amdgpu_metrics_history_word(const void *snapshot, size_t size,
+						   unsigned int i)
+{
+	uint32_t word = 0;
+
+	memcpy(&word, snapshot + i * sizeof(word), min(sizeof(word), size - i * sizeof(word)));
+	return word;
+}
+
+/*
+ * Encode @cur against @prev (both @size bytes) into @dst, or only calculate the
+ * size of the delta if @dst is NULL.
+ *
+ * Returns the size of the delta.
+ */
+static inline size_t amdgpu_metrics_history_delta_encode(void *dst, const void *prev,
+							 const void *cur, size_t size)
+{
+	struct amdgpu_metrics_history_run run;
+	unsigned int nwords = DIV_ROUND_UP(size, sizeof(uint32_t));
+	unsigned int i, j, end;
+	size_t len = 0;
+	uint32_t xor;
+
+	for (i = 0; i < nwords; i = end) {
+		if (amdgpu_metrics_history_word(prev, size, i) ==
+		    amdgpu_metrics_history_word(cur, size, i)) {
+			end = i + 1;
+			continue;
+		}
+
+		/*
+		 * Bridge a single unchanged word: it costs no more than the header
+		 * of a new run.
+		 */
+		for (end = i + 1; end < nwords; end++) {
+			if (amdgpu_metrics_history_word(prev, size, end) !=
+			    amdgpu_metrics_history_word(cur, size, end))
+				continue;
+			if (end + 1 < nwords &&
+			    amdgpu_metrics_history_word(prev, size, end + 1) !=
+			    amdgpu_metrics_history_word(cur, size, end + 1))
+				continue;
+			break;
+		}
+
+		if (dst) {
+			run = (struct amdgpu_metrics_history_run) {
+				.word = i,
+				.nwords = end - i,
+			};
+			memcpy(dst + len, &run, sizeof(run));
+			for (j = i; j < end; j++) {
+				xor = amdgpu_metrics_history_word(prev, size, j) ^
+				      amdgpu_metrics_history_word(cur, size, j);
+				memcpy(dst + len + sizeof(run) + (j - i) * sizeof(xor), &xor,
+				       sizeof(xor));
+			}
+		}
+		len += sizeof(run) + (end - i) * sizeof(xor);
+	}
+
+	return len;
+}
+
+/* Apply @delta to @snapshot (@size bytes) in place. */
+static inline int amdgpu_metrics_history_delta_decode(void *snapshot, size_t size,
+						      const void *delta, size_t delta_size)
+{
+	struct amdgpu_metrics_history_run run;
+	unsigned int nwords = DIV_ROUND_UP(size, sizeof(uint32_t));
+	unsigned int j;
+	size_t off = 0;
+	uint32_t word, xor;
+
+	while (off < delta_size) {
+		if (off + sizeof(run) > delta_size)
+			return -EINVAL;
+		memcpy(&run, delta + off, sizeof(run));
+		off += sizeof(run);
+
+		if (run.word + run.nwords > nwords ||
+		    off + run.nwords * sizeof(xor) > delta_size)
+			return -EINVAL;
+
+		for (j = run.word; j < run.word + run.nwords; j++) {
+			memcpy(&xor, delta + off, sizeof(xor));
+			off += sizeof(xor);
+			word = amdgpu_metrics_history_word(snapshot, size, j) ^ xor;
+			memcpy(snapshot + j * sizeof(word), &word,
+			       min(sizeof(word), size - j * sizeof(word)));
+		}
+	}
+
+	return 0;
+}
+
 /* All gpu_metrics_v*_* members are unsigned. */
 static int amdgpu_metrics_get_val(const struct amdgpu_metrics_private_common *priv,
 				  channel_t channel, uint64_t *val)
@@ -539,7 +1375,7 @@ static int amdgpu_metrics_get_val(const struct amdgpu_metrics_private_common *pr
 		if (WARN_ON(offset + data_type_enum_to_size(type) > priv->channels->metrics_size))
 			return -EINVAL;
 
-		p = (void *)&priv->metrics + offset;
+		p = (void *)priv->metrics + offset;
 
 		switch (type) {
 		case channel_u8:
@@ -578,11 +1414,29 @@ static int amdgpu_metrics_get_val(const struct amdgpu_metrics_private_common *pr
 	}
 }
 
+/* Like amdgpu_metrics_get_val(), for channels that not all revisions define */
+static int amdgpu_metrics_get_opt_val(const struct amdgpu_metrics_private_common *priv,
+				      channel_t channel, uint64_t *val)
+{
+	return is_channel_valid(channel) ? amdgpu_metrics_get_val(priv, channel, val) : -ENODEV;
+}
+
+/* Like amdgpu_metrics_get_opt_val(), for a channel of xcp_stats[@xcp] */
+static int amdgpu_metrics_get_xcp_val(const struct amdgpu_metrics_private_common *priv,
+				      channel_t channel, unsigned int xcp, uint64_t *val)
+{
+	if (xcp >= NXCP)
+		return -EINVAL;
+
+	channel.offset += xcp * priv->channels->xcp_stride;
+	return amdgpu_metrics_get_opt_val(priv, channel, val);
+}
+
 #define _GET_VAL(_priv_p, _idx, _idx_max, _channel_group, _channel, _val_p)	\
-	_idx >= _idx_max ? -EINVAL : amdgpu_metrics_get_val			\
+	((_idx) >= (_idx_max) ? -EINVAL : amdgpu_metrics_get_val		\
 		((_priv_p),							\
 		 (_priv_p)->channels->_channel_group._channel[_idx],		\
-		 _val_p)
+		 _val_p))
 
 #define GET_TEMP(_priv_p, _idx, _val_p) \
 	_GET_VAL(_priv_p, _idx, NCHANNELS_TEMP, temp, data, _val_p)
@@ -590,6 +1444,15 @@ static int amdgpu_metrics_get_val(const struct amdgpu_metrics_private_common *pr
 #define GET_CORE_TEMP(_priv_p, _idx, _val_p) \
 	_GET_VAL(_priv_p, _idx, NCORES, temp, core, _val_p)
 
+#define GET_IN(_priv_p, _idx, _val_p) \
+	_GET_VAL(_priv_p, _idx, NCHANNELS_IN, in, data, _val_p)
+
+#define GET_CURR(_priv_p, _idx, _val_p) \
+	_GET_VAL(_priv_p, _idx, NCHANNELS_CURR, curr, data, _val_p)
+
+#define GET_FAN(_priv_p, _idx, _val_p) \
+	_GET_VAL(_priv_p, _idx, NCHANNELS_FAN, fan, data, _val_p)
+
 #define GET_POWER(_priv_p, _idx, _val_p) \
 	_GET_VAL(_priv_p, _idx, NCHANNELS_POWER, power, data, _val_p)
 
@@ -602,6 +1465,24 @@ static int amdgpu_metrics_get_val(const struct amdgpu_metrics_private_common *pr
 #define GET_CORE_FREQ(_priv_p, _idx, _val_p) \
 	_GET_VAL(_priv_p, _idx, NCORES, freq, coreclk, _val_p)
 
+#define GET_ACTIVITY(_priv_p, _idx, _val_p) \
+	_GET_VAL(_priv_p, _idx, NCHANNELS_ACTIVITY, activity, data, _val_p)
+
+#define GET_CORE_ACTIVITY(_priv_p, _idx, _val_p) \
+	_GET_VAL(_priv_p, _idx, NCORES, activity, core, _val_p)
+
+#define GET_BANDWIDTH(_priv_p, _idx, _val_p) \
+	_GET_VAL(_priv_p, _idx, NCHANNELS_BANDWIDTH, bandwidth, data, _val_p)
+
+#define GET_BUSY_ACC(_priv_p, _idx, _val_p) \
+	_GET_VAL(_priv_p, _idx, NCHANNELS_BUSY_ACC, busy_acc, data, _val_p)
+
+#define GET_PCIE_ERROR(_priv_p, _idx, _val_p) \
+	_GET_VAL(_priv_p, _idx, NCHANNELS_PCIE_ERROR, pcie_error, data, _val_p)
+
+#define GET_THROTTLE(_priv_p, _idx, _val_p) \
+	_GET_VAL(_priv_p, _idx, NCHANNELS_THROTTLE, throttle, data, _val_p)
+
 static int __init _amdgpu_metrics_validate_core(struct amdgpu_metrics_private_common *priv)
 {
 	bool core_functional;
@@ -617,8 +1498,11 @@ static int __init _amdgpu_metrics_validate_core(struct amdgpu_metrics_private_co
 	for (i = 0; i < NCORES; i++) {
 		if (!priv->remap.temp.core[i].valid &&
 		    !priv->remap.power.core[i].valid &&
-		    !priv->remap.freq.coreclk[i].valid)
+		    !priv->remap.freq.coreclk[i].valid) {
+			/* No such a core, don't trust its activity either. */
+			priv->remap.activity.core[i].valid = false;
 			continue;
+		}
 
 		err_power = !priv->remap.power.core[i].valid || GET_CORE_POWER(priv, i, &power);
 		err_freq = !priv->remap.freq.coreclk[i].valid || GET_CORE_FREQ(priv, i, &freq);
@@ -645,6 +1529,7 @@ static int __init _amdgpu_metrics_validate_core(struct amdgpu_metrics_private_co
 			priv->remap.temp.core[i].valid = false;
 			priv->remap.power.core[i].valid = false;
 			priv->remap.freq.coreclk[i].valid = false;
+			priv->remap.activity.core[i].valid = false;
 			dummy_cores++;
 		}
 	}
@@ -702,12 +1587,12 @@ static int __init amdgpu_metrics_init_priv_common(struct amdgpu_metrics_private_
 	int err;
 
 	pr_info("gpu_metrics v%u.%u, size=%uB\n",
-		(unsigned int)priv->metrics.header.format_revision,
-		(unsigned int)priv->metrics.header.content_revision,
-		(unsigned int)priv->metrics.header.structure_size);
+		(unsigned int)priv->metrics->header.format_revision,
+		(unsigned int)priv->metrics->header.content_revision,
+		(unsigned int)priv->metrics->header.structure_size);
 
-	err = amdgpu_metrics_get_channels(priv->metrics.header.format_revision,
-					  priv->metrics.header.content_revision,
+	err = amdgpu_metrics_get_channels(priv->metrics->header.format_revision,
+					  priv->metrics->header.content_revision,
 					  &priv->channels);
 	if (err) {
 		pr_err("Unsupported gpu_metrics revision\n");
@@ -719,6 +1604,17 @@ static int __init amdgpu_metrics_init_priv_common(struct amdgpu_metrics_private_
 	/* 0 in per-core channels implies ENODEV, otherwise it may be valid. */
 	_amdgpu_metrics_validate_channels(priv, power, NCHANNELS_POWER, false);
 	_amdgpu_metrics_validate_channels(priv, freq, NCHANNELS_FREQ, false);
+	_amdgpu_metrics_validate_channels(priv, in, NCHANNELS_IN, false);
+	_amdgpu_metrics_validate_channels(priv, curr, NCHANNELS_CURR, false);
+	/* A stopped fan is 0 RPM. */
+	_amdgpu_metrics_validate_channels(priv, fan, NCHANNELS_FAN, false);
+	/* Idle is 0% or 0MB/s. */
+	_amdgpu_metrics_validate_channels(priv, activity, NCHANNELS_ACTIVITY, false);
+	_amdgpu_metrics_validate_channels(priv, bandwidth, NCHANNELS_BANDWIDTH, false);
+	/* Accumulators start from 0. */
+	_amdgpu_metrics_validate_channels(priv, busy_acc, NCHANNELS_BUSY_ACC, false);
+	_amdgpu_metrics_validate_channels(priv, throttle, NCHANNELS_THROTTLE, false);
+	_amdgpu_metrics_validate_channels(priv, pcie_error, NCHANNELS_PCIE_ERROR, false);
 
 	/* We handle 0 in per-core power/freq channels here. */
 	err = _amdgpu_metrics_validate_core(priv);
@@ -0,0 +1,411 @@
+/*
+ * KUnit tests and microbenchmarks for amdgpu_metrics
+ *
+ * Copyright (C) 2025  Rongrong <i@rong.moe>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Built as a separate module (make kunit), including the driver itself so that
+ * its static functions can be tested. No GPU is needed: reads of gpu_metrics
+ * are redirected to the tables in data/sample, which are linked in.
+ */
+#define AMDGPU_METRICS_KUNIT
+#define MODULE_NAME	"amdgpu_metrics_kunit"
+#include "amdgpu_metrics.c"
+
+#include <kunit/device.h>
+#include <kunit/static_stub.h>
+#include <kunit/test.h>
+
+#define AMDGPU_METRICS_TEST_SAMPLE(_name)					\
+	extern const u8 gpu_metrics_ ##_name[], gpu_metrics_ ##_name ##_end[];	\
+	asm(".pushsection .rodata\n"						\
+	    ".balign 8\n"							\
+	    "gpu_metrics_" #_name ":\n"						\
+	    ".incbin \"data/sample/gpu_metrics_" #_name "\"\n"			\
+	    "gpu_metrics_" #_name "_end:\n"					\
+	    ".popsection\n")
+
+#define REF_AMDGPU_METRICS_TEST_SAMPLE(_name)					\
+	{									\
+		.name = "gpu_metrics_" #_name,					\
+		.data = gpu_metrics_ ##_name,					\
+		.end = gpu_metrics_ ##_name ##_end,				\
+	}
+
+AMDGPU_METRICS_TEST_SAMPLE(v1_3_rx7600);
+AMDGPU_METRICS_TEST_SAMPLE(v2_1_7840hs);
+AMDGPU_METRICS_TEST_SAMPLE(v2_2_5600g);
+AMDGPU_METRICS_TEST_SAMPLE(v3_0_ai365);
+AMDGPU_METRICS_TEST_SAMPLE(v3_0_aimax395);
+
+static const struct amdgpu_metrics_test_sample {
+	const char *name; /* Also the path to read */
+	const u8 *data;
+	const u8 *end;
+} amdgpu_metrics_test_samples[] = {
+	REF_AMDGPU_METRICS_TEST_SAMPLE(v1_3_rx7600),
+	REF_AMDGPU_METRICS_TEST_SAMPLE(v2_1_7840hs),
+	REF_AMDGPU_METRICS_TEST_SAMPLE(v2_2_5600g),
+	REF_AMDGPU_METRICS_TEST_SAMPLE(v3_0_ai365),
+	REF_AMDGPU_METRICS_TEST_SAMPLE(v3_0_aimax395),
+};
+
+static void amdgpu_metrics_test_sample_desc(const struct amdgpu_metrics_test_sample *sample,
+					    char *desc)
+{
+	strscpy(desc, sample->name, KUNIT_PARAM_DESC_SIZE);
+}
+
+KUNIT_ARRAY_PARAM(amdgpu_metrics_test_samples, amdgpu_metrics_test_samples,
+		  amdgpu_metrics_test_sample_desc);
+
+/* Replaces amdgpu_metrics_read_gpu_metrics(), unknown paths don't exist. */
+static ssize_t amdgpu_metrics_test_read(const char *path, struct metrics_table_header *metrics,
+					size_t buf_size)
+{
+	const struct amdgpu_metrics_test_sample *sample;
+	unsigned int i;
+	size_t size;
+
+	for (i = 0; i < ARRAY_SIZE(amdgpu_metrics_test_samples); i++) {
+		sample = &amdgpu_metrics_test_samples[i];
+		if (strcmp(path, sample->name))
+			continue;
+
+		size = sample->end - sample->data;
+		if (size > buf_size)
+			return -EIO;
+
+		memcpy(metrics, sample->data, size);
+		return size;
+	}
+
+	return -ENOENT;
+}
+
+KUNIT_DEFINE_ACTION_WRAPPER(amdgpu_metrics_test_free_percpu, free_percpu,
+			    struct amdgpu_metrics_stats __percpu *);
+
+/*
+ * Set up a device like amdgpu_metrics_register_path() does, minus registering
+ * it. @dev gets the device passed to the HWMON callbacks.
+ */
+static struct amdgpu_metrics_private *__init
+amdgpu_metrics_test_priv(struct kunit *test, struct device **dev)
+{
+	const struct amdgpu_metrics_test_sample *sample = test->param_value;
+	struct amdgpu_metrics_private *priv;
+	ssize_t size;
+
+	kunit_activate_static_stub(test, amdgpu_metrics_read_gpu_metrics,
+				   amdgpu_metrics_test_read);
+
+	priv = kunit_kzalloc(test, sizeof(*priv), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, priv);
+	priv->common.metrics = kunit_kzalloc(test, sizeof(union gpu_metrics), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, priv->common.metrics);
+
+	priv->path = sample->name;
+	size = amdgpu_metrics_read_gpu_metrics(priv->path, &priv->common.metrics->header,
+					       sizeof(union gpu_metrics));
+	KUNIT_ASSERT_EQ(test, size, sample->end - sample->data);
+
+	KUNIT_ASSERT_EQ(test, amdgpu_metrics_init_priv(priv, true), 0);
+	amdgpu_metrics_refresh_init(&priv->refresh);
+
+	priv->stats = alloc_percpu(struct amdgpu_metrics_stats);
+	KUNIT_ASSERT_NOT_NULL(test, priv->stats);
+	KUNIT_ASSERT_EQ(test, kunit_add_action_or_reset(test, amdgpu_metrics_test_free_percpu,
+							priv->stats), 0);
+
+	*dev = kunit_device_register(test, "amdgpu_metrics_test");
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, *dev);
+	dev_set_drvdata(*dev, priv);
+
+	return priv;
+}
+
+static u64 amdgpu_metrics_test_stat(const struct amdgpu_metrics_private *priv, size_t offset)
+{
+	unsigned int cpu;
+	u64 sum = 0;
+
+	for_each_possible_cpu(cpu)
+		sum += *(u64 *)((void *)per_cpu_ptr(priv->stats, cpu) + offset);
+
+	return sum;
+}
+
+#define AMDGPU_METRICS_TEST_STAT(_priv, _member) \
+	amdgpu_metrics_test_stat((_priv), offsetof(struct amdgpu_metrics_stats, _member))
+
+/* The label attribute of a sensor type, or -1 if it has none */
+static s64 amdgpu_metrics_test_label_attr(enum hwmon_sensor_types type)
+{
+	switch (type) {
+	case hwmon_temp:
+		return hwmon_temp_label;
+	case hwmon_power:
+		return hwmon_power_label;
+	case hwmon_in:
+		return hwmon_in_label;
+	case hwmon_curr:
+		return hwmon_curr_label;
+	case hwmon_fan:
+		return hwmon_fan_label;
+	default:
+		return -1;
+	}
+}
+
+/* Every visible channel of @groups must be readable. */
+static void amdgpu_metrics_test_ext_groups(struct kunit *test, struct amdgpu_metrics_private *priv,
+					   const struct amdgpu_metrics_ext_group *const *groups,
+					   unsigned int ngroups)
+{
+	const struct amdgpu_metrics_ext_group *group;
+	unsigned int i, channel, kind;
+	s64 val;
+	int err;
+
+	guard(rwsem_read)(&priv->refresh.metrics_lock);
+
+	for (i = 0; i < ngroups; i++) {
+		group = groups[i];
+		for (channel = 0; channel < group->nchannels; channel++) {
+			for (kind = 0; kind < group->nkinds; kind++) {
+				if (!group->is_visible(priv, channel, kind))
+					continue;
+
+				err = group->read(priv, channel, kind, &val);
+				/* Rates need two refreshes. */
+				KUNIT_EXPECT_TRUE_MSG(test, !err || err == -ENODATA,
+						      "%s%u_%s: %d", group->prefix, channel + 1,
+						      group->kinds[kind], err);
+			}
+		}
+	}
+}
+
+static void __init amdgpu_metrics_test_init_priv_common(struct kunit *test)
+{
+	const struct amdgpu_metrics_test_sample *sample = test->param_value;
+	struct amdgpu_metrics_private *priv;
+	unsigned int i, ntemp = 0, ncore = 0;
+	struct device *dev;
+
+	priv = amdgpu_metrics_test_priv(test, &dev);
+
+	KUNIT_EXPECT_EQ(test, priv->common.channels->metrics_size, sample->end - sample->data);
+
+	for (i = 0; i < NCHANNELS_TEMP; i++)
+		ntemp += priv->common.remap.temp.data[i].valid;
+	KUNIT_EXPECT_GT(test, ntemp, 0);
+
+	for (i = 0; i < NCORES; i++)
+		ncore += priv->per_core_channel_remap[i].valid;
+	KUNIT_EXPECT_EQ(test, priv->common.has_per_core, ncore > 0);
+}
+
+static void __init amdgpu_metrics_test_hwmon_read(struct kunit *test)
+{
+	const struct amdgpu_metrics_select_type *type;
+	struct amdgpu_metrics_private *priv;
+	struct device *dev;
+	unsigned int i, channel;
+	const char *label;
+	long val;
+	s64 attr;
+	int err;
+
+	priv = amdgpu_metrics_test_priv(test, &dev);
+
+	for (i = 0; i < ARRAY_SIZE(amdgpu_metrics_select_types); i++) {
+		type = &amdgpu_metrics_select_types[i];
+		for (channel = 0; channel < type->nchannels; channel++) {
+			if (!amdgpu_metrics_hwmon_ops.is_visible(priv, type->type, type->attr,
+								 channel))
+				continue;
+
+			err = amdgpu_metrics_hwmon_ops.read(dev, type->type, type->attr, channel,
+							    &val);
+			KUNIT_EXPECT_EQ_MSG(test, err, 0, "%s%u_input", type->prefix, channel + 1);
+
+			/* 0 is invalid, anything hotter is corrupted. */
+			if (!err && type->type == hwmon_temp) {
+				KUNIT_EXPECT_GT(test, val, 0);
+				KUNIT_EXPECT_LE(test, val, 150000);
+			}
+
+			attr = amdgpu_metrics_test_label_attr(type->type);
+			if (attr < 0)
+				continue;
+
+			err = amdgpu_metrics_hwmon_ops.read_string(dev, type->type, attr, channel,
+								   &label);
+			KUNIT_EXPECT_EQ_MSG(test, err, 0, "%s%u_label", type->prefix, channel + 1);
+		}
+	}
+
+	for (channel = 0; channel < NCORES; channel++) {
+		if (amdgpu_metrics_per_core_ops.is_visible(priv, hwmon_temp, hwmon_temp_input,
+							   channel))
+			KUNIT_EXPECT_EQ(test, amdgpu_metrics_per_core_ops.read(dev, hwmon_temp,
+									       hwmon_temp_input,
+									       channel, &val), 0);
+		if (amdgpu_metrics_per_core_ops.is_visible(priv, hwmon_power, hwmon_power_input,
+							   channel))
+			KUNIT_EXPECT_EQ(test, amdgpu_metrics_per_core_ops.read(dev, hwmon_power,
+									       hwmon_power_input,
+									       channel, &val), 0);
+	}
+
+	amdgpu_metrics_test_ext_groups(test, priv, amdgpu_metrics_ext_groups,
+				       ARRAY_SIZE(amdgpu_metrics_ext_groups));
+	amdgpu_metrics_test_ext_groups(test, priv, amdgpu_metrics_per_core_ext_groups,
+				       ARRAY_SIZE(amdgpu_metrics_per_core_ext_groups));
+}
+
+static void __init amdgpu_metrics_test_refresh(struct kunit *test)
+{
+	const struct amdgpu_metrics_test_sample *sample = test->param_value;
+	struct amdgpu_metrics_private *priv;
+	struct device *dev;
+
+	priv = amdgpu_metrics_test_priv(test, &dev);
+
+	KUNIT_EXPECT_EQ(test, amdgpu_metrics_update_gpu_metrics(priv, true), 1);
+	KUNIT_EXPECT_EQ(test, priv->refresh.generation, 1);
+	KUNIT_EXPECT_MEMEQ(test, priv->common.metrics, sample->data, sample->end - sample->data);
+
+	/* Within UPDATE_INTERVAL_MS */
+	KUNIT_EXPECT_EQ(test, amdgpu_metrics_update_gpu_metrics(priv, false), 0);
+	KUNIT_EXPECT_EQ(test, AMDGPU_METRICS_TEST_STAT(priv, skipped), 1);
+
+	KUNIT_EXPECT_EQ(test, amdgpu_metrics_update_gpu_metrics(priv, true), 1);
+	KUNIT_EXPECT_EQ(test, priv->refresh.generation, 2);
+
+	/* A failed refresh keeps the last snapshot. */
+	priv->path = "gpu_metrics_missing";
+	KUNIT_EXPECT_EQ(test, amdgpu_metrics_update_gpu_metrics(priv, true), -ENOENT);
+	KUNIT_EXPECT_EQ(test, priv->refresh.generation, 2);
+	KUNIT_EXPECT_EQ(test, AMDGPU_METRICS_TEST_STAT(priv, errors), 1);
+	KUNIT_EXPECT_EQ(test, AMDGPU_METRICS_TEST_STAT(priv, refreshes), 3);
+	KUNIT_EXPECT_MEMEQ(test, priv->common.metrics, sample->data, sample->end - sample->data);
+}
+
+#define AMDGPU_METRICS_TEST_BENCH_READS		100000
+#define AMDGPU_METRICS_TEST_BENCH_REFRESHES	10000
+
+/* HWMON reads of the first temperature, served from the snapshot */
+static void __init amdgpu_metrics_test_bench_read(struct kunit *test)
+{
+	const struct amdgpu_metrics_test_sample *sample = test->param_value;
+	struct amdgpu_metrics_private *priv;
+	struct device *dev;
+	unsigned int i, channel = 0;
+	u64 start, elapsed;
+	long val;
+
+	priv = amdgpu_metrics_test_priv(test, &dev);
+
+	while (!amdgpu_metrics_hwmon_ops.is_visible(priv, hwmon_temp, hwmon_temp_input, channel))
+		KUNIT_ASSERT_LT(test, ++channel, NCHANNELS_TEMP);
+
+	KUNIT_ASSERT_EQ(test, amdgpu_metrics_update_gpu_metrics(priv, true), 1);
+
+	start = ktime_get_ns();
+	for (i = 0; i < AMDGPU_METRICS_TEST_BENCH_READS; i++)
+		amdgpu_metrics_hwmon_ops.read(dev, hwmon_temp, hwmon_temp_input, channel, &val);
+	elapsed = ktime_get_ns() - start;
+
+	kunit_info(test, "%s: %llu ns/read\n", sample->name,
+		   div_u64(elapsed, AMDGPU_METRICS_TEST_BENCH_READS));
+}
+
+/* Refreshes without SMU round-trips, i.e., the cost of decoding */
+static void __init amdgpu_metrics_test_bench_refresh(struct kunit *test)
+{
+	const struct amdgpu_metrics_test_sample *sample = test->param_value;
+	struct amdgpu_metrics_private *priv;
+	struct device *dev;
+	u64 start, elapsed;
+	unsigned int i;
+
+	priv = amdgpu_metrics_test_priv(test, &dev);
+
+	start = ktime_get_ns();
+	for (i = 0; i < AMDGPU_METRICS_TEST_BENCH_REFRESHES; i++)
+		amdgpu_metrics_update_gpu_metrics(priv, true);
+	elapsed = ktime_get_ns() - start;
+
+	KUNIT_EXPECT_EQ(test, priv->refresh.generation, AMDGPU_METRICS_TEST_BENCH_REFRESHES);
+	kunit_info(test, "%s: %llu ns/refresh\n", sample->name,
+		   div_u64(elapsed, AMDGPU_METRICS_TEST_BENCH_REFRESHES));
+}
+
+static void amdgpu_metrics_test_unregister(void *data)
+{
+	amdgpu_metrics_cleanup();
+}
+
+/*
+ * Register everything once, like loading the driver does. The devices are
+ * removed when the test ends, as nothing may read them without the stub.
+ */
+static void __init amdgpu_metrics_test_register(struct kunit *test)
+{
+	kunit_activate_static_stub(test, amdgpu_metrics_read_gpu_metrics,
+				   amdgpu_metrics_test_read);
+	/* Actions run in reverse, so this runs before the stub is deactivated. */
+	KUNIT_ASSERT_EQ(test, kunit_add_action_or_reset(test, amdgpu_metrics_test_unregister,
+							NULL), 0);
+
+	strscpy(gpu_metrics_path, "gpu_metrics_v3_0_ai365", sizeof(gpu_metrics_path));
+	KUNIT_EXPECT_EQ(test, amdgpu_metrics_init(), 0);
+}
+
+static struct kunit_case __refdata amdgpu_metrics_test_cases[] = {
+	KUNIT_CASE_PARAM(amdgpu_metrics_test_init_priv_common,
+			 amdgpu_metrics_test_samples_gen_params),
+	KUNIT_CASE_PARAM(amdgpu_metrics_test_hwmon_read, amdgpu_metrics_test_samples_gen_params),
+	KUNIT_CASE_PARAM(amdgpu_metrics_test_refresh, amdgpu_metrics_test_samples_gen_params),
+	KUNIT_CASE(amdgpu_metrics_test_register),
+	{}
+};
+
+static struct kunit_suite amdgpu_metrics_test_suite = {
+	.name = "amdgpu_metrics",
+	.test_cases = amdgpu_metrics_test_cases,
+};
+
+static struct kunit_case __refdata amdgpu_metrics_bench_cases[] = {
+	KUNIT_CASE_PARAM(amdgpu_metrics_test_bench_read, amdgpu_metrics_test_samples_gen_params),
+	KUNIT_CASE_PARAM(amdgpu_metrics_test_bench_refresh,
+			 amdgpu_metrics_test_samples_gen_params),
+	{}
+};
+
+static struct kunit_suite amdgpu_metrics_bench_suite = {
+	.name = "amdgpu_metrics_bench",
+	.test_cases = amdgpu_metrics_bench_cases,
+};
+
+kunit_test_init_section_suites(&amdgpu_metrics_test_suite, &amdgpu_metrics_bench_suite);
+
+module_exit(amdgpu_metrics_exit);
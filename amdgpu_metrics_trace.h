@@ -0,0 +1,179 @@
+/*
+ * Tracepoints for amdgpu_metrics
+ *
+ * Copyright (C) 2025  Rongrong <i@rong.moe>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM amdgpu_metrics
+
+#if !defined(AMDGPU_METRICS_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define AMDGPU_METRICS_TRACE_H
+
+#include <linux/hwmon.h>
+#include <linux/tracepoint.h>
+
+#include "amdgpu_metrics.h"
+
+TRACE_EVENT(amdgpu_metrics_refresh_start,
+	TP_PROTO(const char *path, bool force),
+	TP_ARGS(path, force),
+
+	TP_STRUCT__entry(
+		__string(path, path)
+		__field(bool, force)
+	),
+
+	TP_fast_assign(
+		__assign_str(path);
+		__entry->force = force;
+	),
+
+	TP_printk("path=%s force=%d", __get_str(path), __entry->force)
+);
+
+/* @size is what kernel_read() returned, i.e., a negative error code on failure. */
+TRACE_EVENT(amdgpu_metrics_refresh_end,
+	TP_PROTO(const char *path, const struct metrics_table_header *header, ssize_t size,
+		 int err, u64 duration_ns),
+	TP_ARGS(path, header, size, err, duration_ns),
+
+	TP_STRUCT__entry(
+		__string(path, path)
+		__field(u8, format_revision)
+		__field(u8, content_revision)
+		__field(u16, structure_size)
+		__field(ssize_t, size)
+		__field(int, err)
+		__field(u64, duration_ns)
+	),
+
+	TP_fast_assign(
+		__assign_str(path);
+		__entry->format_revision = header->format_revision;
+		__entry->content_revision = header->content_revision;
+		__entry->structure_size = header->structure_size;
+		__entry->size = size;
+		__entry->err = err;
+		__entry->duration_ns = duration_ns;
+	),
+
+	TP_printk("path=%s v%u.%u structure_size=%u size=%zd err=%d duration_ns=%llu",
+		  __get_str(path), __entry->format_revision, __entry->content_revision,
+		  __entry->structure_size, __entry->size, __entry->err,
+		  __entry->duration_ns)
+);
+
+TRACE_DEFINE_ENUM(hwmon_temp);
+TRACE_DEFINE_ENUM(hwmon_power);
+TRACE_DEFINE_ENUM(hwmon_in);
+TRACE_DEFINE_ENUM(hwmon_curr);
+TRACE_DEFINE_ENUM(hwmon_fan);
+TRACE_DEFINE_ENUM(hwmon_intrusion);
+
+TRACE_EVENT(amdgpu_metrics_read,
+	TP_PROTO(const char *path, enum hwmon_sensor_types type, int channel, bool core,
+		 int err, long val),
+	TP_ARGS(path, type, channel, core, err, val),
+
+	TP_STRUCT__entry(
+		__string(path, path)
+		__field(int, type)
+		__field(int, channel)
+		__field(bool, core)
+		__field(int, err)
+		__field(long, val)
+	),
+
+	TP_fast_assign(
+		__assign_str(path);
+		__entry->type = type;
+		__entry->channel = channel;
+		__entry->core = core;
+		__entry->err = err;
+		__entry->val = val;
+	),
+
+	/* Frequencies are read through hwmon_intrusion, see hwmon_magic_freq. */
+	TP_printk("path=%s type=%s channel=%d core=%d err=%d val=%ld",
+		  __get_str(path),
+		  __print_symbolic(__entry->type,
+				   { hwmon_temp, "temp" },
+				   { hwmon_power, "power" },
+				   { hwmon_in, "in" },
+				   { hwmon_curr, "curr" },
+				   { hwmon_fan, "fan" },
+				   { hwmon_intrusion, "freq" }),
+		  __entry->channel, __entry->core, __entry->err, __entry->val)
+);
+
+#define AMDGPU_METRICS_TRACE_CHANNELS(_entry, _common, _channel_group, _size, _get_val)	\
+do {											\
+	unsigned int i;									\
+	uint64_t raw;									\
+	for (i = 0; i < (_size); i++)							\
+		(_entry)->_channel_group[i] =						\
+			(_common)->remap._channel_group.data[i].valid &&		\
+			!_get_val((_common), i, &raw) ? raw : U64_MAX;			\
+} while (0)
+
+/*
+ * All channels after a successful refresh, indexed as in the channel tables, in
+ * the units of gpu_metrics (centi-Celsius, mW, MHz, mV, mA and RPM). Invalid
+ * channels are U64_MAX.
+ */
+TRACE_EVENT(amdgpu_metrics_sample,
+	TP_PROTO(const char *path, const struct amdgpu_metrics_private_common *common),
+	TP_ARGS(path, common),
+
+	TP_STRUCT__entry(
+		__string(path, path)
+		__array(u64, temp, NCHANNELS_TEMP)
+		__array(u64, power, NCHANNELS_POWER)
+		__array(u64, freq, NCHANNELS_FREQ)
+		__array(u64, in, NCHANNELS_IN)
+		__array(u64, curr, NCHANNELS_CURR)
+		__array(u64, fan, NCHANNELS_FAN)
+	),
+
+	TP_fast_assign(
+		__assign_str(path);
+		AMDGPU_METRICS_TRACE_CHANNELS(__entry, common, temp, NCHANNELS_TEMP, GET_TEMP);
+		AMDGPU_METRICS_TRACE_CHANNELS(__entry, common, power, NCHANNELS_POWER, GET_POWER);
+		AMDGPU_METRICS_TRACE_CHANNELS(__entry, common, freq, NCHANNELS_FREQ, GET_FREQ);
+		AMDGPU_METRICS_TRACE_CHANNELS(__entry, common, in, NCHANNELS_IN, GET_IN);
+		AMDGPU_METRICS_TRACE_CHANNELS(__entry, common, curr, NCHANNELS_CURR, GET_CURR);
+		AMDGPU_METRICS_TRACE_CHANNELS(__entry, common, fan, NCHANNELS_FAN, GET_FAN);
+	),
+
+	TP_printk("path=%s temp=%s power=%s freq=%s in=%s curr=%s fan=%s", __get_str(path),
+		  __print_array(__entry->temp, NCHANNELS_TEMP, sizeof(u64)),
+		  __print_array(__entry->power, NCHANNELS_POWER, sizeof(u64)),
+		  __print_array(__entry->freq, NCHANNELS_FREQ, sizeof(u64)),
+		  __print_array(__entry->in, NCHANNELS_IN, sizeof(u64)),
+		  __print_array(__entry->curr, NCHANNELS_CURR, sizeof(u64)),
+		  __print_array(__entry->fan, NCHANNELS_FAN, sizeof(u64)))
+);
+
+#endif /* AMDGPU_METRICS_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE amdgpu_metrics_trace
+
+#include <trace/define_trace.h>
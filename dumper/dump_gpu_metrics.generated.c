@@ -1579,6 +1579,103 @@ static void __dump_gpu_metrics_v3_0(const struct gpu_metrics_v3_0 *metrics)
 	printf(__tableFormat, "time_filter_alphavalue", (unsigned long long)metrics->time_filter_alphavalue);
 }
 
+static void __dump_amdgpu_pmmetrics_header(const struct amdgpu_pmmetrics_header *metrics)
+{
+	char __attribute__((unused)) buf[64] = "";
+
+	printf(__tableFormat, "structure_size", (unsigned long long)metrics->structure_size);
+	printf(__tableFormat, "pad", (unsigned long long)metrics->pad);
+	printf(__tableFormat, "mp1_ip_discovery_version", (unsigned long long)metrics->mp1_ip_discovery_version);
+	printf(__tableFormat, "pmfw_version", (unsigned long long)metrics->pmfw_version);
+	printf(__tableFormat, "pmmetrics_version", (unsigned long long)metrics->pmmetrics_version);
+}
+
+static void __dump_amdgpu_pm_metrics(const struct amdgpu_pm_metrics *metrics)
+{
+	char __attribute__((unused)) buf[64] = "";
+
+	printf(__subStructFormat, "amdgpu_pmmetrics_header", "common_header {");
+	__dump_amdgpu_pmmetrics_header(&metrics->common_header);
+	printf(__subStructFormat, "", "}");
+
+}
+
+static void __dump_amdgpu_partition_metrics_v1_0(const struct amdgpu_partition_metrics_v1_0 *metrics)
+{
+	char __attribute__((unused)) buf[64] = "";
+
+	printf(__subStructFormat, "metrics_table_header", "common_header {");
+	__dump_metrics_table_header(&metrics->common_header);
+	printf(__subStructFormat, "", "}");
+	/* Current clocks (Mhz) */
+	for (unsigned i = 0; i < MAX_XCC; i++)
+	{
+		sprintf(buf, "current_gfxclk[%u]", i);
+		printf(__tableFormat, buf, (unsigned long long)metrics->current_gfxclk[i]);
+	}
+	for (unsigned i = 0; i < MAX_CLKS; i++)
+	{
+		sprintf(buf, "current_socclk[%u]", i);
+		printf(__tableFormat, buf, (unsigned long long)metrics->current_socclk[i]);
+	}
+	for (unsigned i = 0; i < MAX_CLKS; i++)
+	{
+		sprintf(buf, "current_vclk0[%u]", i);
+		printf(__tableFormat, buf, (unsigned long long)metrics->current_vclk0[i]);
+	}
+	for (unsigned i = 0; i < MAX_CLKS; i++)
+	{
+		sprintf(buf, "current_dclk0[%u]", i);
+		printf(__tableFormat, buf, (unsigned long long)metrics->current_dclk0[i]);
+	}
+	printf(__tableFormat, "current_uclk", (unsigned long long)metrics->current_uclk);
+	printf(__tableFormat, "padding", (unsigned long long)metrics->padding);
+
+	/* Utilization Instantaneous (%) */
+	for (unsigned i = 0; i < MAX_XCC; i++)
+	{
+		sprintf(buf, "gfx_busy_inst[%u]", i);
+		printf(__tableFormat, buf, (unsigned long long)metrics->gfx_busy_inst[i]);
+	}
+	for (unsigned i = 0; i < NUM_JPEG_ENG_V1; i++)
+	{
+		sprintf(buf, "jpeg_busy[%u]", i);
+		printf(__tableFormat, buf, (unsigned long long)metrics->jpeg_busy[i]);
+	}
+	for (unsigned i = 0; i < NUM_VCN; i++)
+	{
+		sprintf(buf, "vcn_busy[%u]", i);
+		printf(__tableFormat, buf, (unsigned long long)metrics->vcn_busy[i]);
+	}
+	/* Utilization Accumulated (%) */
+	for (unsigned i = 0; i < MAX_XCC; i++)
+	{
+		sprintf(buf, "gfx_busy_acc[%u]", i);
+		printf(__tableFormat, buf, (unsigned long long)metrics->gfx_busy_acc[i]);
+	}
+	/* Total App Clock Counter Accumulated */
+	for (unsigned i = 0; i < MAX_XCC; i++)
+	{
+		sprintf(buf, "gfx_below_host_limit_ppt_acc[%u]", i);
+		printf(__tableFormat, buf, (unsigned long long)metrics->gfx_below_host_limit_ppt_acc[i]);
+	}
+	for (unsigned i = 0; i < MAX_XCC; i++)
+	{
+		sprintf(buf, "gfx_below_host_limit_thm_acc[%u]", i);
+		printf(__tableFormat, buf, (unsigned long long)metrics->gfx_below_host_limit_thm_acc[i]);
+	}
+	for (unsigned i = 0; i < MAX_XCC; i++)
+	{
+		sprintf(buf, "gfx_low_utilization_acc[%u]", i);
+		printf(__tableFormat, buf, (unsigned long long)metrics->gfx_low_utilization_acc[i]);
+	}
+	for (unsigned i = 0; i < MAX_XCC; i++)
+	{
+		sprintf(buf, "gfx_below_host_limit_total_acc[%u]", i);
+		printf(__tableFormat, buf, (unsigned long long)metrics->gfx_below_host_limit_total_acc[i]);
+	}
+}
+
 int dump_gpu_metrics(const void *metrics)
 {
 	struct metrics_table_header *header = (struct metrics_table_header *)metrics;
@@ -1637,3 +1734,27 @@ int dump_gpu_metrics(const void *metrics)
 	}
 	return 0;
 }
+
+int dump_partition_metrics(const void *metrics)
+{
+	struct metrics_table_header *header = (struct metrics_table_header *)metrics;
+
+	printf(__tableHeader);
+
+	switch ((header->format_revision << 8) | header->content_revision)
+	{
+	case (1 << 8) | 0:
+		__dump_amdgpu_partition_metrics_v1_0((struct amdgpu_partition_metrics_v1_0 *)metrics);
+		break;
+	default:
+		return -1;
+	}
+	return 0;
+}
+
+int dump_pm_metrics(const void *metrics)
+{
+	printf(__tableHeader);
+	__dump_amdgpu_pm_metrics((struct amdgpu_pm_metrics *)metrics);
+	return 0;
+}
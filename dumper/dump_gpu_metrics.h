@@ -15,5 +15,7 @@
 #include "../vendor/kgd_pp_interface.h"
 
 int dump_gpu_metrics(const void *);
+int dump_partition_metrics(const void *);
+int dump_pm_metrics(const void *);
 
 #endif /* DUMP_GPU_METRICS_H */
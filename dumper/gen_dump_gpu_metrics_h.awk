@@ -51,6 +51,32 @@ function add_dump_substruct(substruct, member, disp_var, comment) {
 	add_printf("__subStructFormat, \"\", \"}\"", comment);
 }
 
+# Dispatch on the revision in metrics_table_header, among the structs in rev_map
+function add_dump_dispatch(name, rev_map) {
+	add_line();
+	add_line("int " name "(const void *metrics)");
+	add_line("{"); INDENT++;
+	add_line("struct metrics_table_header *header = (struct metrics_table_header *)metrics;");
+	add_line();
+	add_printf("__tableHeader");
+	add_line();
+	add_line("switch ((header->format_revision << 8) | header->content_revision)");
+	add_line("{");
+	for (combined in rev_map) {
+		split(combined, rev, SUBSEP); fr = rev[1]; cr = rev[2]; struct_name = rev_map[combined];
+		add_line("case (" fr " << 8) | " cr ":");
+		INDENT++;
+		add_line(FUNC_PREFIX struct_name "((struct " struct_name " *)metrics);");
+		add_line("break;");
+		INDENT--;
+	}
+	add_line("default:");
+	INDENT++; add_line("return -1;"); INDENT--;
+	add_line("}");
+	add_line("return 0;")
+	INDENT--; add_line("}");
+}
+
 BEGIN {
 	PROCINFO["sorted_in"] = "@ind_str_asc";
 	STRUCT_NAME = "";
@@ -69,13 +95,16 @@ BEGIN {
 	add_line("static const char __subStructFormat[] = \"| %-30s | %-15s |\\n\";");
 }
 
-match($0, /^struct (gpu_metrics_v([0-9]+)_([0-9]+)|amdgpu_xcp_metrics\w*|metrics_table_header)\s*\{/, arr) {
+match($0, /^struct (gpu_metrics_v([0-9]+)_([0-9]+)|amdgpu_partition_metrics_v([0-9]+)_([0-9]+)|amdgpu_xcp_metrics\w*|amdgpu_pmmetrics_header|amdgpu_pm_metrics|metrics_table_header)\s*\{/, arr) {
 	if (STRUCT_NAME != "")
 		err("Unexpected nested struct definition!");
 	STRUCT_NAME = arr[1]; fr = arr[2]; cr = arr[3];
 	func_name = FUNC_PREFIX STRUCT_NAME;
 	if (fr != "" && cr != "")
 		REV_MAP[fr, cr] = STRUCT_NAME;
+	# Partition metrics share metrics_table_header, but not the revisions.
+	if (arr[4] != "" && arr[5] != "")
+		PARTITION_REV_MAP[arr[4], arr[5]] = STRUCT_NAME;
 	add_line();
 	add_line("static void " func_name "(const struct " STRUCT_NAME " *metrics)");
 	add_line("{"); INDENT++;
@@ -129,26 +158,15 @@ STRUCT_NAME != "" && /^};$/ {
 }
 
 END {
+	add_dump_dispatch("dump_gpu_metrics", REV_MAP);
+	add_dump_dispatch("dump_partition_metrics", PARTITION_REV_MAP);
+
+	# pm_metrics has its own header, followed by an opaque payload.
 	add_line();
-	add_line("int dump_gpu_metrics(const void *metrics)");
+	add_line("int dump_pm_metrics(const void *metrics)");
 	add_line("{"); INDENT++;
-	add_line("struct metrics_table_header *header = (struct metrics_table_header *)metrics;");
-	add_line();
 	add_printf("__tableHeader");
-	add_line();
-	add_line("switch ((header->format_revision << 8) | header->content_revision)");
-	add_line("{");
-	for (combined in REV_MAP) {
-		split(combined, rev, SUBSEP); fr = rev[1]; cr = rev[2]; struct_name = REV_MAP[combined];
-		add_line("case (" fr " << 8) | " cr ":");
-		INDENT++;
-		add_line(FUNC_PREFIX struct_name "((struct " struct_name " *)metrics);");
-		add_line("break;");
-		INDENT--;
-	}
-	add_line("default:");
-	INDENT++; add_line("return -1;"); INDENT--;
-	add_line("}");
-	add_line("return 0;")
+	add_line(FUNC_PREFIX "amdgpu_pm_metrics((struct amdgpu_pm_metrics *)metrics);");
+	add_line("return 0;");
 	INDENT--; add_line("}");
 }
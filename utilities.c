@@ -21,11 +21,15 @@
 #define _GNU_SOURCE
 
 #include <assert.h>
+#include <fcntl.h>
 #include <glob.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "amdgpu_metrics.h"
@@ -33,7 +37,20 @@
 
 #define BUF_SIZE 1024
 
+#define BENCH_SNAPSHOTS 4096
+#define BENCH_KEYFRAME 64 /* The default of history_keyframe_interval */
+#define BENCH_ROUNDS 64
+
+#define BENCH_CONCURRENT_MS 1000
+#define BENCH_MAX_THREADS 64
+/* Latencies are bucketed within 12.5%, 8 buckets per power of 2 */
+#define BENCH_LATENCY_SUB_BITS 3
+#define NBENCH_LATENCY_BUCKETS ((64 - BENCH_LATENCY_SUB_BITS + 1) << BENCH_LATENCY_SUB_BITS)
+
 static const char gpu_metrics_glob[] = "/sys/class/drm/render*/device/gpu_metrics";
+/* Main, per-core, NPU and XCP devices are all registered under the module's device. */
+static const char hwmon_glob[] = "/sys/class/amdgpu_metrics/amdgpu_metrics/hwmon/hwmon*";
+static const char gpu_metrics_param[] = "/sys/module/amdgpu_metrics/parameters/gpu_metrics";
 
 static int read_gpu_metrics(const char *path, struct metrics_table_header *metrics, size_t size)
 {
@@ -74,14 +91,52 @@ do {										\
 	}									\
 } while (0)
 
+#define SHOW_LINK(_priv_p, _kind)							\
+do {											\
+	for (unsigned int i = 0; i < NCHANNELS_LINK; i++) {				\
+		char label[32];								\
+		uint64_t val;								\
+		if (amdgpu_metrics_get_opt_val((_priv_p),				\
+					       (_priv_p)->channels->link._kind.data[i],	\
+					       &val))					\
+			continue;							\
+		snprintf(label, sizeof(label), "%s %s",					\
+			 amdgpu_metrics_labels_link[i], #_kind);			\
+		printf("| %-30s | %15lu |\n", label, val);				\
+	}										\
+} while (0)
+
+#define SHOW_OPT(_priv_p, _mbr)							\
+do {										\
+	uint64_t val;								\
+	if (!amdgpu_metrics_get_opt_val((_priv_p), (_priv_p)->channels->_mbr, &val))	\
+		printf("| %-30s | %15lu |\n", #_mbr, val);			\
+} while (0)
+
+#define SHOW_XCP(_priv_p, _xcp, _mbr, _labels)						\
+do {											\
+	for (unsigned int i = 0; i < ARRAY_SIZE((_priv_p)->channels->xcp._mbr); i++) {	\
+		char label[48];								\
+		uint64_t val;								\
+		if (amdgpu_metrics_get_xcp_val((_priv_p),				\
+					       (_priv_p)->channels->xcp._mbr[i],	\
+					       (_xcp), &val))				\
+			continue;							\
+		snprintf(label, sizeof(label), "%s %s", _labels[i], #_mbr);		\
+		printf("| %-30s | %15lu |\n", label, val);				\
+	}										\
+} while (0)
+
 static int test_path(const char *path)
 {
-	struct amdgpu_metrics_private_common priv = { 0 };
+	union gpu_metrics metrics = { 0 };
+	struct amdgpu_metrics_private_common priv = { .metrics = &metrics };
+	uint64_t status, num_partition;
 	int err;
 
 	pr_info("Testing against '%s'\n", path);
 
-	err = read_gpu_metrics(path, &priv.metrics.header, sizeof(priv.metrics));
+	err = read_gpu_metrics(path, &metrics.header, sizeof(metrics));
 	if (err)
 		return err;
 
@@ -95,7 +150,214 @@ static int test_path(const char *path)
 	SHOW_CHANNELS(&priv, NCHANNELS_TEMP, temp, amdgpu_metrics_labels_temp, GET_TEMP);
 	SHOW_CHANNELS(&priv, NCHANNELS_POWER, power, amdgpu_metrics_labels_power, GET_POWER);
 	SHOW_CHANNELS(&priv, NCHANNELS_FREQ, freq, amdgpu_metrics_labels_freq, GET_FREQ);
+	SHOW_CHANNELS(&priv, NCHANNELS_IN, in, amdgpu_metrics_labels_in, GET_IN);
+	SHOW_CHANNELS(&priv, NCHANNELS_CURR, curr, amdgpu_metrics_labels_curr, GET_CURR);
+	SHOW_CHANNELS(&priv, NCHANNELS_FAN, fan, amdgpu_metrics_labels_fan, GET_FAN);
+	SHOW_OPT(&priv, power_cap);
+	SHOW_OPT(&priv, power_cap_max);
+	SHOW_CHANNELS(&priv, NCHANNELS_ACTIVITY, activity, amdgpu_metrics_labels_activity,
+		      GET_ACTIVITY);
+	SHOW_CHANNELS(&priv, NCHANNELS_BANDWIDTH, bandwidth, amdgpu_metrics_labels_bandwidth,
+		      GET_BANDWIDTH);
+	SHOW_CHANNELS(&priv, NCHANNELS_BUSY_ACC, busy_acc, amdgpu_metrics_labels_busy_acc,
+		      GET_BUSY_ACC);
+	SHOW_CHANNELS(&priv, NCHANNELS_THROTTLE, throttle, amdgpu_metrics_labels_throttle,
+		      GET_THROTTLE);
+	SHOW_CHANNELS(&priv, NCHANNELS_PCIE_ERROR, pcie_error, amdgpu_metrics_labels_pcie_error,
+		      GET_PCIE_ERROR);
+
+	printf("| ========= [ %-18s |     ] ========= |\n", "link");
+	SHOW_LINK(&priv, width);
+	SHOW_LINK(&priv, speed);
+	SHOW_LINK(&priv, bandwidth);
+	SHOW_LINK(&priv, read_acc);
+	SHOW_LINK(&priv, write_acc);
+	SHOW_LINK(&priv, status);
+
+	if (amdgpu_metrics_get_opt_val(&priv, priv.channels->num_partition, &num_partition))
+		num_partition = 0;
+	for (unsigned int xcp = 0; xcp < num_partition && xcp < NXCP; xcp++) {
+		char group[16];
+
+		snprintf(group, sizeof(group), "xcp %u", xcp);
+		printf("| ========= [ %-18s |     ] ========= |\n", group);
+		SHOW_XCP(&priv, xcp, gfx_busy, amdgpu_metrics_labels_xcc);
+		SHOW_XCP(&priv, xcp, vcn_busy, amdgpu_metrics_labels_vcn);
+		SHOW_XCP(&priv, xcp, jpeg_busy, amdgpu_metrics_labels_jpeg);
+		SHOW_XCP(&priv, xcp, below_host_limit, amdgpu_metrics_labels_xcc);
+		SHOW_XCP(&priv, xcp, below_host_limit_ppt, amdgpu_metrics_labels_xcc);
+		SHOW_XCP(&priv, xcp, below_host_limit_thm, amdgpu_metrics_labels_xcc);
+		SHOW_XCP(&priv, xcp, low_utilization, amdgpu_metrics_labels_xcc);
+	}
+
+	if (!amdgpu_metrics_get_opt_val(&priv, priv.channels->indep_throttle_status, &status)) {
+		printf("| ========= [ %-18s |     ] ========= |\n", "throttler");
+		for (unsigned int i = 0; i < NCHANNELS_THROTTLER; i++)
+			printf("| %-30s | %15u |\n", amdgpu_metrics_labels_throttler[i],
+			       (unsigned int)(status >> amdgpu_metrics_throttler_bits[i] & 1));
+	}
+
+	return err;
+}
+
+static void *read_file(const char *path, size_t *size)
+{
+	FILE *file = fopen(path, "rb");
+	size_t capacity = BUF_SIZE;
+	char *buf = NULL, *p;
+
+	if (file == NULL) {
+		pr_err("Failed to open %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	*size = 0;
+	do {
+		capacity *= 2;
+		p = realloc(buf, capacity);
+		if (p == NULL) {
+			pr_err("Failed to allocate %zu bytes\n", capacity);
+			goto out_free;
+		}
+		buf = p;
+		/* debugfs and sysfs files can't tell their size in advance */
+		*size += fread(buf + *size, 1, capacity - *size, file);
+	} while (*size == capacity);
+
+	if (ferror(file)) {
+		pr_err("Failed to read %s: %s\n", path, strerror(errno));
+		goto out_free;
+	}
+
+	fclose(file);
+	return buf;
+
+out_free:
+	free(buf);
+	fclose(file);
+	return NULL;
+}
+
+static bool is_history(const char *path)
+{
+	FILE *file = fopen(path, "rb");
+	uint32_t magic;
+
+	if (file == NULL)
+		return false;
+
+	if (fread(&magic, sizeof(magic), 1, file) != 1)
+		magic = 0;
+
+	fclose(file);
+	return magic == AMDGPU_METRICS_HISTORY_MAGIC;
+}
+
+static int dump_history(const char *path)
+{
+	const struct amdgpu_metrics_history_header *header;
+	const struct amdgpu_metrics_history_record *record;
+	union gpu_metrics snapshot = { 0 };
+	size_t size, off, snapshot_size = 0;
+	int err = 0;
+	char *buf;
+
+	buf = read_file(path, &size);
+	if (buf == NULL)
+		return -EIO;
+
+	header = (struct amdgpu_metrics_history_header *)buf;
+	if (size < sizeof(*header) || header->version != AMDGPU_METRICS_HISTORY_VERSION) {
+		pr_err("Unsupported history format in '%s'\n", path);
+		err = -EINVAL;
+		goto out;
+	}
+
+	pr_info("History: %u records%s\n", header->nr_records,
+		header->flags & AMDGPU_METRICS_HISTORY_FROZEN ? ", frozen" : "");
+
+	off = sizeof(*header);
+	for (uint32_t i = 0; i < header->nr_records; i++) {
+		record = (struct amdgpu_metrics_history_record *)(buf + off);
+		if (off + sizeof(*record) > size ||
+		    off + AMDGPU_METRICS_HISTORY_RECORD_SIZE(record->size) > size) {
+			pr_err("Truncated history record %u in '%s'\n", i, path);
+			err = -EINVAL;
+			goto out;
+		}
+
+		printf("| %-30s | %15llu |\n"
+		       "| %-30s | %15llu |\n",
+		       "History: generation", (unsigned long long)record->seq,
+		       "History: timestamp (ns)", (unsigned long long)record->timestamp_ns);
+
+		switch (record->kind) {
+		case history_keyframe:
+			if (record->size > sizeof(snapshot)) {
+				snapshot_size = 0;
+				break;
+			}
+			snapshot_size = record->size;
+			memcpy(&snapshot, record + 1, snapshot_size);
+			break;
+		case history_delta:
+			if (snapshot_size &&
+			    amdgpu_metrics_history_delta_decode(&snapshot, snapshot_size,
+								record + 1, record->size))
+				snapshot_size = 0;
+			break;
+		default:
+			snapshot_size = 0;
+			break;
+		}
+
+		if (!snapshot_size || dump_gpu_metrics(&snapshot)) {
+			pr_err("Failed to dump history record %u in '%s'\n", i, path);
+			err = -EINVAL;
+		}
+
+		off += AMDGPU_METRICS_HISTORY_RECORD_SIZE(record->size);
+	}
 
+out:
+	free(buf);
+	return err;
+}
+
+static bool has_basename(const char *path, const char *name)
+{
+	const char *base = strrchr(path, '/');
+
+	return strstr(base ? base + 1 : path, name) != NULL;
+}
+
+/* pm_metrics and partition metrics, both starting with the 16-bit structure_size */
+static int dump_companion(const char *path, int (*dump)(const void *), size_t min_size)
+{
+	size_t size;
+	int err = 0;
+	char *buf;
+
+	buf = read_file(path, &size);
+	if (buf == NULL)
+		return -EIO;
+
+	if (size < min_size || size != *(uint16_t *)buf) {
+		pr_err("Invalid size of '%s': read %zu, declared %u\n", path, size,
+		       size >= sizeof(uint16_t) ? *(uint16_t *)buf : 0);
+		err = -EINVAL;
+		goto out;
+	}
+
+	err = dump(buf);
+	if (err)
+		pr_err("Failed to dump '%s': v%u.%u, size=%zuB\n", path,
+		       (unsigned int)((struct metrics_table_header *)buf)->format_revision,
+		       (unsigned int)((struct metrics_table_header *)buf)->content_revision,
+		       size);
+
+out:
+	free(buf);
 	return err;
 }
 
@@ -106,6 +368,17 @@ static int dump_path(const char *path)
 
 	pr_info("Dumping '%s'\n", path);
 
+	if (is_history(path))
+		return dump_history(path);
+
+	/* Neither has a magic, tell them by name. */
+	if (has_basename(path, "pm_metrics"))
+		return dump_companion(path, dump_pm_metrics, sizeof(struct amdgpu_pm_metrics));
+
+	if (has_basename(path, "partition_metrics") || has_basename(path, "xcp_metrics"))
+		return dump_companion(path, dump_partition_metrics,
+				      sizeof(struct amdgpu_partition_metrics_v1_0));
+
 	err = read_gpu_metrics(path, &metrics.header, sizeof(metrics));
 	if (err)
 		return err;
@@ -122,6 +395,753 @@ static int dump_path(const char *path)
 	return 0;
 }
 
+static uint32_t bench_rand(uint32_t *state)
+{
+	/* xorshift32, deterministic across runs */
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+/* Random walk of a valid channel, as a sensor would do between two samples. */
+static void bench_perturb(struct amdgpu_metrics_private_common *priv, const channel_t *channels,
+			  const remap_t *remaps, size_t size, uint32_t *state)
+{
+	uint64_t val, max;
+	void *p;
+
+	for (size_t i = 0; i < size; i++) {
+		int step = (int)(bench_rand(state) % 5) - 2;
+
+		if (!remaps[i].valid || !step)
+			continue;
+
+		p = (void *)priv->metrics + channels[i].offset;
+		switch (channels[i].type) {
+		case channel_u8:
+			val = *(uint8_t *)p;
+			max = U8_MAX;
+			break;
+		case channel_u16:
+			val = *(uint16_t *)p;
+			max = U16_MAX;
+			break;
+		case channel_u32:
+			val = *(uint32_t *)p;
+			max = U32_MAX;
+			break;
+		case channel_u64:
+			val = *(uint64_t *)p;
+			max = U64_MAX;
+			break;
+		default:
+			continue;
+		}
+
+		/* Keep U*_MAX (invalid) and 0 (may be invalid) as is */
+		if (val < 3 || val > max - 3)
+			continue;
+		val += step;
+
+		switch (channels[i].type) {
+		case channel_u8:
+			*(uint8_t *)p = val;
+			break;
+		case channel_u16:
+			*(uint16_t *)p = val;
+			break;
+		case channel_u32:
+			*(uint32_t *)p = val;
+			break;
+		case channel_u64:
+			*(uint64_t *)p = val;
+			break;
+		default:
+			unreachable();
+		}
+	}
+}
+
+#define BENCH_PERTURB(_priv_p, _channel_group, _size, _state_p)				\
+	bench_perturb((_priv_p), (_priv_p)->channels->_channel_group.data,		\
+		      (_priv_p)->remap._channel_group.data, (_size), (_state_p))
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Record a series of synthetic snapshots the way the flight recorder does, and
+ * report the memory saved by delta encoding and the decoding throughput.
+ */
+static int bench_path(const char *path)
+{
+	union gpu_metrics metrics = { 0 };
+	struct amdgpu_metrics_private_common priv = { .metrics = &metrics };
+	const struct amdgpu_metrics_history_record *record;
+	struct amdgpu_metrics_history_record *new_record;
+	size_t size, off, raw_size, payload_size, nkeyframes = 0;
+	char *snapshots = NULL, *buf = NULL;
+	union gpu_metrics snapshot;
+	uint32_t state = 0x9e3779b9;
+	double start, elapsed;
+	bool keyframe;
+	int err;
+
+	pr_info("Benchmarking history against '%s'\n", path);
+
+	err = read_gpu_metrics(path, &metrics.header, sizeof(metrics));
+	if (err)
+		return err;
+
+	err = amdgpu_metrics_init_priv_common(&priv);
+	if (err)
+		return err;
+
+	size = priv.channels->metrics_size;
+	raw_size = BENCH_SNAPSHOTS * AMDGPU_METRICS_HISTORY_RECORD_SIZE(size);
+	snapshots = malloc(BENCH_SNAPSHOTS * size);
+	buf = malloc(raw_size);
+	if (snapshots == NULL || buf == NULL) {
+		pr_err("Failed to allocate %zu bytes\n", BENCH_SNAPSHOTS * size + raw_size);
+		err = -ENOMEM;
+		goto out;
+	}
+
+	for (size_t i = 0; i < BENCH_SNAPSHOTS; i++) {
+		if (i) {
+			BENCH_PERTURB(&priv, temp, NCHANNELS_TEMP, &state);
+			BENCH_PERTURB(&priv, power, NCHANNELS_POWER, &state);
+			BENCH_PERTURB(&priv, freq, NCHANNELS_FREQ, &state);
+		}
+		memcpy(snapshots + i * size, &metrics, size);
+	}
+
+	/* Same as amdgpu_metrics_history_record(), minus eviction */
+	off = 0;
+	for (size_t i = 0; i < BENCH_SNAPSHOTS; i++) {
+		const char *cur = snapshots + i * size;
+
+		keyframe = i % BENCH_KEYFRAME == 0;
+		payload_size = size;
+		if (!keyframe) {
+			payload_size = amdgpu_metrics_history_delta_encode(NULL, cur - size, cur,
+									   size);
+			keyframe = payload_size >= size;
+		}
+		if (keyframe) {
+			payload_size = size;
+			nkeyframes++;
+		}
+
+		new_record = (struct amdgpu_metrics_history_record *)(buf + off);
+		*new_record = (struct amdgpu_metrics_history_record) {
+			.seq = i,
+			.size = payload_size,
+			.kind = keyframe ? history_keyframe : history_delta,
+		};
+		if (keyframe)
+			memcpy(new_record + 1, cur, size);
+		else
+			amdgpu_metrics_history_delta_encode(new_record + 1, cur - size, cur, size);
+
+		off += AMDGPU_METRICS_HISTORY_RECORD_SIZE(payload_size);
+	}
+
+	start = bench_now();
+	for (int round = 0; round < BENCH_ROUNDS; round++) {
+		for (size_t i = 0, decoded = 0; i < BENCH_SNAPSHOTS; i++) {
+			record = (struct amdgpu_metrics_history_record *)(buf + decoded);
+			if (record->kind == history_keyframe)
+				memcpy(&snapshot, record + 1, size);
+			else if (amdgpu_metrics_history_delta_decode(&snapshot, size, record + 1,
+								     record->size))
+				err = -EINVAL;
+			decoded += AMDGPU_METRICS_HISTORY_RECORD_SIZE(record->size);
+
+			if (round == 0 && memcmp(&snapshot, snapshots + i * size, size))
+				err = -EINVAL;
+		}
+	}
+	elapsed = bench_now() - start;
+
+	if (err) {
+		pr_err("Round trip of '%s' failed\n", path);
+		goto out;
+	}
+
+	printf("| v%u.%u %6zuB | %10.1f KiB | %8.1f KiB | %5.1f%% "
+	       "| %5zu B | %6.2f M/s | %10.1f MiB/s |\n",
+	       (unsigned int)metrics.header.format_revision,
+	       (unsigned int)metrics.header.content_revision, size,
+	       raw_size / 1024.0, off / 1024.0, 100.0 * (raw_size - off) / raw_size,
+	       (off - nkeyframes * AMDGPU_METRICS_HISTORY_RECORD_SIZE(size)) /
+	       (BENCH_SNAPSHOTS - nkeyframes),
+	       BENCH_ROUNDS * BENCH_SNAPSHOTS / elapsed / 1e6,
+	       BENCH_ROUNDS * BENCH_SNAPSHOTS * size / elapsed / (1 << 20));
+
+out:
+	free(snapshots);
+	free(buf);
+	return err;
+}
+
+static void bench_header(void)
+{
+	printf("%d snapshots, a keyframe every %d, with valid sensor channels random-walking\n\n"
+	       "|    Table     |   Uncompressed |   Compressed | Saved  "
+	       "| Delta   | Decoding   | Decoding         |\n"
+	       "|--------------|----------------|--------------|--------"
+	       "|---------|------------|------------------|\n",
+	       BENCH_SNAPSHOTS, BENCH_KEYFRAME);
+}
+
+static uint64_t bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned int bench_latency_bucket(uint64_t ns)
+{
+	unsigned int exp;
+
+	if (ns < (1 << BENCH_LATENCY_SUB_BITS))
+		return ns;
+
+	exp = 63 - __builtin_clzll(ns);
+	return ((exp - BENCH_LATENCY_SUB_BITS + 1) << BENCH_LATENCY_SUB_BITS) +
+	       ((ns >> (exp - BENCH_LATENCY_SUB_BITS)) & ((1 << BENCH_LATENCY_SUB_BITS) - 1));
+}
+
+/* The lower bound of a bucket */
+static uint64_t bench_latency_ns(unsigned int bucket)
+{
+	unsigned int exp;
+
+	if (bucket < (1 << BENCH_LATENCY_SUB_BITS))
+		return bucket;
+
+	exp = (bucket >> BENCH_LATENCY_SUB_BITS) + BENCH_LATENCY_SUB_BITS - 1;
+	return (1ULL << exp) |
+	       ((uint64_t)(bucket & ((1 << BENCH_LATENCY_SUB_BITS) - 1)) <<
+		(exp - BENCH_LATENCY_SUB_BITS));
+}
+
+static uint64_t bench_percentile(const uint64_t *latency, uint64_t total, double percentile)
+{
+	uint64_t rank = total * percentile / 100, seen = 0;
+
+	for (unsigned int i = 0; i < NBENCH_LATENCY_BUCKETS; i++) {
+		seen += latency[i];
+		if (seen > rank)
+			return bench_latency_ns(i);
+	}
+
+	return 0;
+}
+
+struct bench_concurrent {
+	const char *path; /* The stand-in */
+	union gpu_metrics metrics;
+	struct amdgpu_metrics_private_common priv;
+	struct amdgpu_metrics_refresh refresh;
+	unsigned int channels[NCHANNELS_TEMP]; /* Those visible in HWMON */
+	unsigned int nchannels;
+	uint64_t errors; /* Protected by metrics_lock */
+	bool stop;
+};
+
+struct bench_concurrent_thread {
+	struct bench_concurrent *bench;
+	pthread_t thread;
+	uint64_t reads;
+	uint64_t latency[NBENCH_LATENCY_BUCKETS];
+	int err;
+};
+
+static int bench_concurrent_update(void *data, bool force)
+{
+	struct bench_concurrent *bench = data;
+	int err;
+
+	(void)force;
+	err = read_gpu_metrics(bench->path, &bench->metrics.header, sizeof(bench->metrics));
+	if (err)
+		bench->errors++;
+
+	return err ? -EIO : 0;
+}
+
+static const struct amdgpu_metrics_refresh_ops bench_concurrent_ops = {
+	.update = bench_concurrent_update,
+};
+
+/* What amdgpu_metrics_read() does for each HWMON read, minus the kernel bookkeeping */
+static void *bench_concurrent_thread(void *data)
+{
+	struct bench_concurrent_thread *thread = data;
+	struct bench_concurrent *bench = thread->bench;
+	uint64_t start, val;
+
+	while (!__atomic_load_n(&bench->stop, __ATOMIC_RELAXED)) {
+		start = bench_now_ns();
+
+		thread->err = amdgpu_metrics_refresh(&bench->refresh, &bench_concurrent_ops, bench,
+						     false);
+		if (thread->err < 0)
+			break;
+
+		down_read(&bench->refresh.metrics_lock);
+		/* Channels without a measurement fail as they would in HWMON. */
+		(void)GET_TEMP(&bench->priv, bench->channels[thread->reads % bench->nchannels],
+			       &val);
+		up_read(&bench->refresh.metrics_lock);
+
+		thread->latency[bench_latency_bucket(bench_now_ns() - start)]++;
+		thread->reads++;
+	}
+
+	return NULL;
+}
+
+static int bench_concurrent_run(struct bench_concurrent *bench, unsigned int nthreads)
+{
+	static struct bench_concurrent_thread threads[BENCH_MAX_THREADS];
+	static uint64_t latency[NBENCH_LATENCY_BUCKETS];
+	struct timespec duration = {
+		.tv_sec = BENCH_CONCURRENT_MS / 1000,
+		.tv_nsec = BENCH_CONCURRENT_MS % 1000 * 1000000L,
+	};
+	uint64_t reads = 0, generation = bench->refresh.generation, errors = bench->errors;
+	unsigned int started;
+	double start, elapsed;
+	int err = 0;
+
+	memset(threads, 0, sizeof(threads));
+	memset(latency, 0, sizeof(latency));
+	bench->stop = false;
+
+	start = bench_now();
+	for (started = 0; started < nthreads; started++) {
+		threads[started].bench = bench;
+		err = -pthread_create(&threads[started].thread, NULL, bench_concurrent_thread,
+				      &threads[started]);
+		if (err) {
+			pr_err("Failed to create a thread: %s\n", strerror(-err));
+			break;
+		}
+	}
+
+	if (!err)
+		nanosleep(&duration, NULL);
+	__atomic_store_n(&bench->stop, true, __ATOMIC_RELAXED);
+
+	for (unsigned int i = 0; i < started; i++) {
+		pthread_join(threads[i].thread, NULL);
+		err = err ?: threads[i].err < 0 ? threads[i].err : 0;
+		reads += threads[i].reads;
+		for (unsigned int j = 0; j < NBENCH_LATENCY_BUCKETS; j++)
+			latency[j] += threads[i].latency[j];
+	}
+	elapsed = bench_now() - start;
+
+	if (err)
+		return err;
+
+	printf("| %7u | %10.2f M/s | %8lu | %8lu | %8lu | %9lu | %6lu |\n",
+	       nthreads, reads / elapsed / 1e6,
+	       bench_percentile(latency, reads, 50), bench_percentile(latency, reads, 99),
+	       bench_percentile(latency, reads, 99.9),
+	       bench->refresh.generation - generation, bench->errors - errors);
+	return 0;
+}
+
+/*
+ * Hammer HWMON-style reads from 1..N threads against a copy of the table on
+ * tmpfs, refreshed as amdgpu_metrics_update_gpu_metrics() does, and report the
+ * throughput, the tail latency and how many refreshes the readers triggered.
+ */
+static int bench_concurrent_path(const char *path)
+{
+	static struct bench_concurrent bench;
+	const char *dir = access("/dev/shm", W_OK) ? "/tmp" : "/dev/shm";
+	char stand_in[64];
+	unsigned int nthreads;
+	void *buf = NULL;
+	size_t size;
+	long ncpus;
+	int fd, err;
+
+	pr_info("Benchmarking concurrent reads against '%s'\n", path);
+
+	memset(&bench, 0, sizeof(bench));
+	bench.priv.metrics = &bench.metrics;
+	err = read_gpu_metrics(path, &bench.metrics.header, sizeof(bench.metrics));
+	if (err)
+		return err;
+
+	err = amdgpu_metrics_init_priv_common(&bench.priv);
+	if (err)
+		return err;
+
+	for (unsigned int i = 0; i < NCHANNELS_TEMP; i++) {
+		if (bench.priv.remap.temp.data[i].valid)
+			bench.channels[bench.nchannels++] = i;
+	}
+	if (!bench.nchannels) {
+		pr_err("No temperature channel in '%s'\n", path);
+		return -ENODATA;
+	}
+
+	buf = read_file(path, &size);
+	if (buf == NULL)
+		return -EIO;
+
+	snprintf(stand_in, sizeof(stand_in), "%s/amdgpu_metrics.XXXXXX", dir);
+	fd = mkstemp(stand_in);
+	if (fd < 0) {
+		pr_err("Failed to create %s: %s\n", stand_in, strerror(errno));
+		free(buf);
+		return -errno;
+	}
+	if (write(fd, buf, size) != (ssize_t)size) {
+		pr_err("Failed to write %s: %s\n", stand_in, strerror(errno));
+		err = -EIO;
+	}
+	close(fd);
+	free(buf);
+	if (err)
+		goto out;
+
+	bench.path = stand_in;
+	amdgpu_metrics_refresh_init(&bench.refresh);
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	nthreads = ncpus < 1 ? 1 : min(ncpus, BENCH_MAX_THREADS);
+
+	printf("%d ms per run against %s, refreshing every %d ms\n\n"
+	       "| Threads |          Reads |   p50 ns |   p99 ns | p99.9 ns | Refreshes | Errors |\n"
+	       "|---------|----------------|----------|----------|----------|-----------|--------|\n",
+	       BENCH_CONCURRENT_MS, stand_in, UPDATE_INTERVAL_MS);
+	for (unsigned int n = 1; n < nthreads * 2 && !err; n *= 2)
+		err = bench_concurrent_run(&bench, min(n, nthreads));
+	printf("\n");
+
+out:
+	unlink(stand_in);
+	return err;
+}
+
+/* One scrape reads every *_input of the module once, as sensors(1) would. */
+struct bench_scrape {
+	char **attrs;
+	char **labels; /* "<hwmon name>/<attribute>" */
+	size_t nattrs;
+	const char *gpu_metrics; /* Read directly instead of scraping, if set */
+	bool stop;
+};
+
+struct bench_scrape_thread {
+	struct bench_scrape *bench;
+	pthread_t thread;
+	uint64_t scrapes;
+	uint64_t errors;
+	uint64_t latency[NBENCH_LATENCY_BUCKETS]; /* Of scrapes or direct reads */
+	uint64_t *attr_latency; /* NBENCH_LATENCY_BUCKETS for each attribute */
+};
+
+/* Open, read and close, like libsensors does for each attribute */
+static int bench_scrape_read(const char *path, void *buf, size_t size)
+{
+	ssize_t n;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	n = read(fd, buf, size);
+	if (n < 0)
+		n = -errno;
+
+	close(fd);
+	return n < 0 ? n : 0;
+}
+
+static void *bench_scrape_thread(void *data)
+{
+	struct bench_scrape_thread *thread = data;
+	struct bench_scrape *bench = thread->bench;
+	union gpu_metrics metrics;
+	uint64_t start, attr_start, now;
+	char buf[32];
+
+	while (!__atomic_load_n(&bench->stop, __ATOMIC_RELAXED)) {
+		start = bench_now_ns();
+
+		if (bench->gpu_metrics) {
+			if (bench_scrape_read(bench->gpu_metrics, &metrics, sizeof(metrics)))
+				thread->errors++;
+			now = bench_now_ns();
+		} else {
+			now = start;
+			for (size_t i = 0; i < bench->nattrs; i++) {
+				attr_start = now;
+				if (bench_scrape_read(bench->attrs[i], buf, sizeof(buf)))
+					thread->errors++;
+				now = bench_now_ns();
+				thread->attr_latency[i * NBENCH_LATENCY_BUCKETS +
+						     bench_latency_bucket(now - attr_start)]++;
+			}
+		}
+
+		thread->latency[bench_latency_bucket(now - start)]++;
+		thread->scrapes++;
+	}
+
+	return NULL;
+}
+
+/* Merges the latency of each attribute into @attr_latency, if scraping. */
+static int bench_scrape_run(struct bench_scrape *bench, unsigned int nthreads,
+			    uint64_t *attr_latency)
+{
+	static struct bench_scrape_thread threads[BENCH_MAX_THREADS];
+	static uint64_t latency[NBENCH_LATENCY_BUCKETS];
+	struct timespec duration = {
+		.tv_sec = BENCH_CONCURRENT_MS / 1000,
+		.tv_nsec = BENCH_CONCURRENT_MS % 1000 * 1000000L,
+	};
+	size_t nbuckets = bench->nattrs * NBENCH_LATENCY_BUCKETS;
+	uint64_t scrapes = 0, errors = 0;
+	unsigned int started;
+	double start, elapsed;
+	int err = 0;
+
+	memset(threads, 0, sizeof(threads));
+	memset(latency, 0, sizeof(latency));
+	bench->stop = false;
+
+	for (unsigned int i = 0; i < nthreads; i++) {
+		threads[i].bench = bench;
+		threads[i].attr_latency = calloc(nbuckets, sizeof(uint64_t));
+		if (threads[i].attr_latency == NULL) {
+			pr_err("Failed to allocate %zu bytes\n", nbuckets * sizeof(uint64_t));
+			err = -ENOMEM;
+			goto out;
+		}
+	}
+
+	start = bench_now();
+	for (started = 0; started < nthreads; started++) {
+		err = -pthread_create(&threads[started].thread, NULL, bench_scrape_thread,
+				      &threads[started]);
+		if (err) {
+			pr_err("Failed to create a thread: %s\n", strerror(-err));
+			break;
+		}
+	}
+
+	if (!err)
+		nanosleep(&duration, NULL);
+	__atomic_store_n(&bench->stop, true, __ATOMIC_RELAXED);
+
+	for (unsigned int i = 0; i < started; i++) {
+		pthread_join(threads[i].thread, NULL);
+		scrapes += threads[i].scrapes;
+		errors += threads[i].errors;
+		for (unsigned int j = 0; j < NBENCH_LATENCY_BUCKETS; j++)
+			latency[j] += threads[i].latency[j];
+		for (size_t j = 0; attr_latency && j < nbuckets; j++)
+			attr_latency[j] += threads[i].attr_latency[j];
+	}
+	elapsed = bench_now() - start;
+
+	if (err)
+		goto out;
+
+	printf("| %7u | %-8s | %10.0f/s | %9lu | %9lu | %6lu |\n",
+	       nthreads, bench->gpu_metrics ? "direct" : "HWMON", scrapes / elapsed,
+	       bench_percentile(latency, scrapes, 50), bench_percentile(latency, scrapes, 99),
+	       errors);
+
+out:
+	for (unsigned int i = 0; i < nthreads; i++)
+		free(threads[i].attr_latency);
+	return err;
+}
+
+static int bench_scrape_add(struct bench_scrape *bench, const char *hwmon)
+{
+	char path[PATH_MAX], name[32] = "";
+	glob_t globbuf;
+	char **attrs, **labels;
+	FILE *file;
+	int err;
+
+	snprintf(path, sizeof(path), "%s/name", hwmon);
+	file = fopen(path, "r");
+	if (file != NULL) {
+		if (fscanf(file, "%31s", name) != 1)
+			name[0] = '\0';
+		fclose(file);
+	}
+
+	snprintf(path, sizeof(path), "%s/*_input", hwmon);
+	err = glob(path, 0, NULL, &globbuf);
+	if (err == GLOB_NOMATCH)
+		return 0;
+	if (err) {
+		pr_err("Failed to glob '%s': %d\n", path, err);
+		return -EIO;
+	}
+
+	attrs = realloc(bench->attrs, (bench->nattrs + globbuf.gl_pathc) * sizeof(*attrs));
+	if (attrs != NULL)
+		bench->attrs = attrs;
+	labels = realloc(bench->labels, (bench->nattrs + globbuf.gl_pathc) * sizeof(*labels));
+	if (labels != NULL)
+		bench->labels = labels;
+	if (attrs == NULL || labels == NULL) {
+		pr_err("Failed to allocate attributes of '%s'\n", hwmon);
+		err = -ENOMEM;
+		goto out;
+	}
+
+	for (size_t i = 0; i < globbuf.gl_pathc; i++) {
+		const char *attr = strrchr(globbuf.gl_pathv[i], '/') + 1;
+
+		attrs[bench->nattrs] = strdup(globbuf.gl_pathv[i]);
+		if (asprintf(&labels[bench->nattrs], "%s/%s", name, attr) < 0)
+			labels[bench->nattrs] = NULL;
+		if (attrs[bench->nattrs] == NULL || labels[bench->nattrs] == NULL) {
+			free(attrs[bench->nattrs]);
+			free(labels[bench->nattrs]);
+			pr_err("Failed to allocate attributes of '%s'\n", hwmon);
+			err = -ENOMEM;
+			goto out;
+		}
+		bench->nattrs++;
+	}
+
+out:
+	globfree(&globbuf);
+	return err;
+}
+
+/*
+ * Scrape all HWMON devices of the loaded module from 1..N threads, and compare
+ * against reading the gpu_metrics it was loaded with directly.
+ */
+static int bench_scrape(void)
+{
+	static struct bench_scrape bench;
+	uint64_t *attr_latency[2] = { NULL, NULL };
+	char *gpu_metrics = NULL;
+	unsigned int nthreads, n;
+	glob_t globbuf;
+	size_t size;
+	long ncpus;
+	int err;
+
+	if ((err = glob(hwmon_glob, 0, NULL, &globbuf))) {
+		if (err == GLOB_NOMATCH) {
+			pr_warn("No HWMON device of amdgpu_metrics. Is the module loaded?\n");
+			pr_info("Hint: glob path: '%s', error: %d\n", hwmon_glob, err);
+			return 0;
+		}
+		pr_err("Failed to glob '%s': %d", hwmon_glob, err);
+		return -EIO;
+	}
+
+	for (size_t i = 0; i < globbuf.gl_pathc && !err; i++)
+		err = bench_scrape_add(&bench, globbuf.gl_pathv[i]);
+	globfree(&globbuf);
+	if (err)
+		goto out;
+
+	/* The module parameter, e.g., a file in data/sample */
+	gpu_metrics = read_file(gpu_metrics_param, &size);
+	if (gpu_metrics == NULL) {
+		err = -EIO;
+		goto out;
+	}
+	gpu_metrics[strcspn(gpu_metrics, "\n")] = '\0';
+
+	for (int i = 0; i < 2; i++) {
+		attr_latency[i] = calloc(bench.nattrs * NBENCH_LATENCY_BUCKETS, sizeof(uint64_t));
+		if (attr_latency[i] == NULL) {
+			pr_err("Failed to allocate %zu bytes\n",
+			       bench.nattrs * NBENCH_LATENCY_BUCKETS * sizeof(uint64_t));
+			err = -ENOMEM;
+			goto out;
+		}
+	}
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	nthreads = ncpus < 1 ? 1 : min(ncpus, BENCH_MAX_THREADS);
+
+	pr_info("Benchmarking scrapes of %zu attributes against '%s'\n", bench.nattrs, gpu_metrics);
+	printf("%d ms per run, a scrape reads all %zu *_input once, or gpu_metrics directly\n\n"
+	       "| Threads | Source   |    Scrapes   |   p50 ns  |   p99 ns  | Errors |\n"
+	       "|---------|----------|--------------|-----------|-----------|--------|\n",
+	       BENCH_CONCURRENT_MS, bench.nattrs);
+	for (n = 1; n < nthreads * 2 && !err; n *= 2) {
+		/* Per-attribute latencies of the 1-thread and N-thread runs only */
+		bench.gpu_metrics = NULL;
+		err = bench_scrape_run(&bench, min(n, nthreads),
+				       n == 1 ? attr_latency[0] :
+				       n >= nthreads ? attr_latency[1] : NULL);
+		if (err)
+			break;
+
+		bench.gpu_metrics = gpu_metrics;
+		err = bench_scrape_run(&bench, min(n, nthreads), NULL);
+	}
+	if (err)
+		goto out;
+
+	printf("\n| %-32s | p50 ns, 1 | p99 ns, 1 | p50 ns, %-2u | p99 ns, %-2u |\n"
+	       "|----------------------------------|-----------|-----------|------------|------------|\n",
+	       "Attribute", nthreads, nthreads);
+	for (size_t i = 0; i < bench.nattrs; i++) {
+		/* The last run is the single-threaded one on uniprocessors. */
+		const uint64_t *last = attr_latency[nthreads == 1 ? 0 : 1] + i * NBENCH_LATENCY_BUCKETS;
+		const uint64_t *first = attr_latency[0] + i * NBENCH_LATENCY_BUCKETS;
+		uint64_t nfirst = 0, nlast = 0;
+
+		for (unsigned int j = 0; j < NBENCH_LATENCY_BUCKETS; j++) {
+			nfirst += first[j];
+			nlast += last[j];
+		}
+
+		printf("| %-32s | %9lu | %9lu | %10lu | %10lu |\n", bench.labels[i],
+		       bench_percentile(first, nfirst, 50), bench_percentile(first, nfirst, 99),
+		       bench_percentile(last, nlast, 50), bench_percentile(last, nlast, 99));
+	}
+	printf("\n");
+
+out:
+	for (size_t i = 0; i < bench.nattrs; i++) {
+		free(bench.attrs[i]);
+		free(bench.labels[i]);
+	}
+	free(bench.attrs);
+	free(bench.labels);
+	free(attr_latency[0]);
+	free(attr_latency[1]);
+	free(gpu_metrics);
+	return err;
+}
+
 static int for_all_gpu_metrics(int (*callback)(const char *), bool fail_fast)
 {
 	glob_t globbuf;
@@ -152,9 +1172,10 @@ out:
 int main(int argc, char *argv[])
 {
 	int i, opt, err = 0;
-	bool test = false, dump = false, fail_fast = false;
+	bool test = false, dump = false, bench = false, concurrent = false, scrape = false;
+	bool fail_fast = false;
 
-	while ((opt = getopt(argc, argv, "tdfh")) != -1) {
+	while ((opt = getopt(argc, argv, "tdzcbfh")) != -1) {
 		switch (opt)
 		{
 		case 't':
@@ -163,24 +1184,44 @@ int main(int argc, char *argv[])
 		case 'd':
 			dump = true;
 			break;
+		case 'z':
+			bench = true;
+			break;
+		case 'c':
+			concurrent = true;
+			break;
+		case 'b':
+			scrape = true;
+			break;
 		case 'f':
 			fail_fast = true;
 			break;
 		case 'h':
 		default:
 			fprintf(stderr,
-				"Usage: %s [-t] [-d] [-f] FILE...\n\n"
+				"Usage: %s [-t] [-d] [-z] [-c] [-b] [-f] FILE...\n\n"
 				"  -t\tTest against the specified files (default)\n"
-				"  -d\tDump everything from the specified files\n"
+				"  -d\tDump everything from the specified files (gpu_metrics, history,\n"
+				"    \tpm_metrics or partition/xcp_metrics, told by name)\n"
+				"  -z\tBenchmark delta-compressed history against the specified files\n"
+				"  -c\tBenchmark concurrent reads against tmpfs copies of the specified files\n"
+				"  -b\tBenchmark scraping the HWMON devices of the loaded module, against\n"
+				"    \treading its gpu_metrics directly (takes no file)\n"
 				"  -f\tFail fast\n",
 				argv[0]);
 			return 1;
 		}
 	}
 
-	if (!test && !dump)
+	if (!test && !dump && !bench && !concurrent && !scrape)
 		test = true;
 
+	if (scrape) {
+		err = bench_scrape();
+		if (err && fail_fast)
+			goto out;
+	}
+
 	if (optind >= argc) {
 		if (test)
 			err = for_all_gpu_metrics(test_path, fail_fast);
@@ -188,6 +1229,14 @@ int main(int argc, char *argv[])
 		if (dump && !(err && fail_fast))
 			err = for_all_gpu_metrics(dump_path, fail_fast);
 
+		if (bench && !(err && fail_fast)) {
+			bench_header();
+			err = for_all_gpu_metrics(bench_path, fail_fast);
+		}
+
+		if (concurrent && !(err && fail_fast))
+			err = for_all_gpu_metrics(bench_concurrent_path, fail_fast);
+
 		goto out;
 	}
 
@@ -206,6 +1255,23 @@ int main(int argc, char *argv[])
 				goto out;
 		}
 	}
+
+	if (bench) {
+		bench_header();
+		for (i = optind; i < argc; i++) {
+			err = bench_path(argv[i]) || err;
+			if (err && fail_fast)
+				goto out;
+		}
+	}
+
+	if (concurrent) {
+		for (i = optind; i < argc; i++) {
+			err = bench_concurrent_path(argv[i]) || err;
+			if (err && fail_fast)
+				goto out;
+		}
+	}
 out:
 	if (err)
 		pr_err("Error(s) occurred. Please check.\n");